@@ -0,0 +1,39 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "resources.hpp"
+#include "texture_atlas.hpp"
+
+// Layout of the asset cache; a cache in any other layout is rebuilt
+const std::uint32_t ASSET_CACHE_VERSION = {1};
+
+// Atlases and images as they are drawn from, so that a later start can map them in rather than decode PNGs. The file
+// is a header, a record for each atlas and image, and then their texels, each run starting on a 64 byte boundary.
+struct AssetPack {
+	std::vector<TextureAtlas> atlases;
+	std::vector<std::shared_ptr<const Image>> images;
+};
+
+auto get_asset_key(const std::vector<std::string>& files, std::uint64_t settings) -> std::uint64_t;
+auto load_asset_cache(const char* file, std::uint64_t key) -> AssetPack;
+auto save_asset_cache(const char* file, std::uint64_t key, const std::vector<const TextureAtlas*>& atlases,
+	const std::vector<const Image*>& images) -> bool;
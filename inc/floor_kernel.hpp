@@ -0,0 +1,56 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+
+// Floor and ceiling textures are always a single 64x64 tile
+const int FLOOR_TEXTURE_SIZE = {64};
+
+// The floor and ceiling of one screen column. Row j of the ceiling (counting down from the top of the screen) and
+// row j of the floor (counting up from the bottom) are the same distance away, so both are drawn from one pass.
+struct FloorSpan {
+	const std::uint32_t* floor_texels;
+	const std::uint32_t* ceiling_texels;
+	std::uint32_t* ceiling_out;				// Top pixel of the column
+	std::uint32_t* floor_out;				// Bottom-most floor pixel of the column
+	int pitch;								// Pixels between framebuffer rows
+	int rows;								// Rows of ceiling (and of floor) to draw
+	float origin_x;							// Player position
+	float origin_y;
+	float dir_x;							// Ray direction divided by the column's distortion correction
+	float dir_y;
+	float surface_height;
+	float min_dist;							// Shading parameters, as for walls
+	float darkest_dist;
+	float darkness_alpha;
+};
+
+// Implementations of the span kernel. The vector kernels do 4 (SSE2) or 8 (AVX2) rows at once in single precision
+// and must produce exactly the same pixels as the scalar one, which is what check_floor_kernel() verifies.
+enum class FloorKernel {
+	automatic,
+	scalar,
+	sse2,
+	avx2
+};
+
+auto select_floor_kernel(FloorKernel requested) -> FloorKernel;
+auto get_floor_kernel() -> FloorKernel;
+auto get_floor_kernel_name(FloorKernel kernel) -> const char*;
+auto is_floor_kernel_supported(FloorKernel kernel) -> bool;
+auto check_floor_kernel(FloorKernel kernel) -> int;
+auto draw_floor_span(const FloorSpan& span) -> void;
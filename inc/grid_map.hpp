@@ -0,0 +1,120 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Cells are kept in 8x8 blocks, each 64 bytes (one cache line), so that looking around a position (as a ray does)
+// touches a handful of lines however wide the map is rather than one line for every row crossed
+const int GRID_BLOCK_SHIFT = {3};
+const int GRID_BLOCK_SIZE = {1 << GRID_BLOCK_SHIFT};
+const int GRID_BLOCK_MASK = {GRID_BLOCK_SIZE - 1};
+
+// Value of every cell outside the map, so a ray always stops at the edge and nothing can walk off it
+const int GRID_EDGE_WALL = {1};
+
+// Wall heights are in tenths of a square up from the floor
+const int GRID_FULL_HEIGHT = {10};
+
+// How a cell is drawn, beyond which wall it is. A wall is made of a lower part from the floor up to its height and an
+// upper part from its lintel up to the ceiling, with nothing in between, so a low wall or a step has no upper part,
+// a window has both and a wall with no gap (height at or above lintel) fills its square. The top of a lower part has
+// the cell's floor texture and the underside of an upper part its ceiling texture. Only the renderer looks at any of
+// this: everything else treats a wall cell as solid.
+struct GridCellStyle {
+	std::uint8_t height;					// Top of the lower part
+	std::uint8_t lintel;					// Bottom of the upper part
+	std::uint8_t floor;						// Floor texture (0 for the map's own, n for wall texture n - 1)
+	std::uint8_t ceiling;					// Ceiling texture, the same way
+};
+
+const GridCellStyle GRID_DEFAULT_STYLE = {GRID_FULL_HEIGHT, GRID_FULL_HEIGHT, 0, 0};
+
+// A map of cells (0 is empty, n is wall texture n - 1). Cell (x, y) covers world x to x + 1 and y to y + 1, so unlike
+// a map written out in rows, y increases upwards.
+struct GridMap {
+	std::vector<std::uint8_t> cells;		// Blocks left to right, bottom to top, each holding its rows bottom first
+	std::vector<std::uint8_t> clearance;	// For each cell, the Chebyshev distance to the nearest wall (0 in a wall)
+	std::vector<GridCellStyle> styles;		// For each cell, laid out as the cells are
+	int width;
+	int height;
+	int blocks_x;							// Blocks in each row of blocks
+	double start_x;							// Where the player starts
+	double start_y;
+	bool layered;							// Whether any wall has a gap or any cell its own floor or ceiling
+};
+
+auto create_grid_map(int width, int height) -> GridMap;
+auto load_grid_map(const char* file) -> GridMap;
+auto tile_grid_map(const GridMap& map, int width, int height) -> GridMap;
+auto build_grid_clearance(GridMap& map) -> void;
+auto get_grid_texture_count(const GridMap& map) -> int;
+
+inline auto get_grid_index(const GridMap& map, int x, int y) -> std::size_t
+{
+	std::size_t block = {static_cast<std::size_t>(y >> GRID_BLOCK_SHIFT) * map.blocks_x + (x >> GRID_BLOCK_SHIFT)};
+	return (block << (2 * GRID_BLOCK_SHIFT)) + ((y & GRID_BLOCK_MASK) << GRID_BLOCK_SHIFT) + (x & GRID_BLOCK_MASK);
+}
+
+inline auto get_grid_cell(const GridMap& map, int x, int y) -> int
+{
+	// Negative coordinates wrap to huge unsigned ones, so one comparison per axis covers both edges
+	if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(map.width) ||
+		static_cast<unsigned int>(y) >= static_cast<unsigned int>(map.height))
+		return GRID_EDGE_WALL;
+
+	return map.cells[get_grid_index(map, x, y)];
+}
+
+// Every cell less than this many cells away in x and in y is empty (so a clearance of 1 only says the cell itself is)
+inline auto get_grid_clearance(const GridMap& map, int x, int y) -> int
+{
+	if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(map.width) ||
+		static_cast<unsigned int>(y) >= static_cast<unsigned int>(map.height))
+		return 0;
+
+	return map.clearance[get_grid_index(map, x, y)];
+}
+
+// Clearance is only brought up to date by build_grid_clearance()
+inline auto set_grid_cell(GridMap& map, int x, int y, int value) -> void
+{
+	map.cells[get_grid_index(map, x, y)] = static_cast<std::uint8_t>(value);
+}
+
+inline auto get_grid_style(const GridMap& map, int x, int y) -> GridCellStyle
+{
+	if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(map.width) ||
+		static_cast<unsigned int>(y) >= static_cast<unsigned int>(map.height))
+		return GRID_DEFAULT_STYLE;
+
+	return map.styles[get_grid_index(map, x, y)];
+}
+
+// Whether a wall cell is solid from the floor to the ceiling
+inline auto is_grid_full_height(const GridMap& map, int x, int y) -> bool
+{
+	GridCellStyle style = {get_grid_style(map, x, y)};
+	return style.height >= style.lintel;
+}
+
+// Layered is only brought up to date by build_grid_clearance(), as clearance is
+inline auto set_grid_style(GridMap& map, int x, int y, const GridCellStyle& style) -> void
+{
+	map.styles[get_grid_index(map, x, y)] = style;
+}
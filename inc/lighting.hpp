@@ -0,0 +1,66 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Shading is quantised into this many light levels, level 0 being full brightness
+const int LIGHT_LEVELS = {64};
+
+// Distance steps per square side in the distance to light level table
+const int LIGHT_DISTANCE_STEPS = {32};
+
+// How light falls off with distance
+struct LightingProfile {
+	const char* name;
+	double min_dist;						// Anything closer is at full brightness
+	double darkest_dist;					// Anything further is at darkness_alpha
+	int darkness_alpha;						// Minimal lighting (0..255)
+};
+
+// Lookup tables for one profile, built once so that swapping profiles at runtime is just swapping which table is
+// used. A distance is turned into a light level, and a light level plus a colour channel value gives the shaded
+// value of that channel, Doom COLORMAP-style (the textures are truecolour so the map is per channel rather than per
+// palette index, which keeps it to 16KB for all levels).
+struct LightTable {
+	LightingProfile profile;
+	std::vector<std::uint8_t> levels;		// Light level for every 1 / LIGHT_DISTANCE_STEPS of distance
+	std::vector<std::uint8_t> colormap;		// LIGHT_LEVELS rows of 256 shaded channel values
+	std::vector<int> darkness;				// Brightness (0..255) of every light level
+	bool shaded;							// False if every level is full brightness, so shading changes nothing
+};
+
+auto build_light_table(const LightingProfile& profile) -> LightTable;
+
+inline auto get_light_level(const LightTable& table, double dist) -> int
+{
+	int step = {static_cast<int>(dist * LIGHT_DISTANCE_STEPS)};
+	int last = {static_cast<int>(table.levels.size()) - 1};
+
+	return table.levels[step < 0 ? 0 : (step > last ? last : step)];
+}
+
+inline auto shade_texel(const std::uint8_t* colormap_row, std::uint32_t texel) -> std::uint32_t
+{
+	return (colormap_row[(texel >> 16) & 0xFF] << 16) | (colormap_row[(texel >> 8) & 0xFF] << 8) |
+		colormap_row[texel & 0xFF];
+}
+
+inline auto get_colormap_row(const LightTable& table, int level) -> const std::uint8_t*
+{
+	return table.colormap.data() + level * 256;
+}
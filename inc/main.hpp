@@ -13,28 +13,55 @@
 // COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
 // OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
 #include <cmath>
+#include <filesystem>
 #include <string>
 #include <iostream>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 #include "libtcod.h"
 
-// Function Prototypes
-template <typename T> auto sign(T val) -> int;
-auto is_colliding (double x, double y) -> bool;
-auto get_pixel(SDL_Surface* surface, int x, int y) -> Uint32;
-auto load_texture(const char* file) -> SDL_Texture*;
-auto load_surface(const char* file) -> SDL_Surface*;
-auto crop_texture(SDL_Texture* source, int x, int y) -> SDL_Texture*;
-auto initialise() -> int;
-auto render() -> void;
-auto update_ticks() -> void;
-auto close() -> void;
-auto update_world() -> void;
-auto main(int argc, char* args[]) -> int;
+#include "allocation_count.hpp"
+#include "asset_cache.hpp"
+#include "benchmark.hpp"
+#include "floor_kernel.hpp"
+#include "grid_map.hpp"
+#include "lighting.hpp"
+#include "movement.hpp"
+#include "profiler.hpp"
+#include "ray_query.hpp"
+#include "raycast.hpp"
+#include "resources.hpp"
+#include "sprite.hpp"
+#include "subcell.hpp"
+#include "texture_atlas.hpp"
+#include "thread_pool.hpp"
+#include "triple_buffer.hpp"
+#include "visibility.hpp"
+
+// Libtcod Window Size (Characters)
+const int WINDOW_WIDTH = {180};
+const int WINDOW_HEIGHT = {100};
+
+// Default Surface Resolution (Pixels): the console's subcell resolution, so every pixel is one quarter of a character
+const int SURFACE_WIDTH = {WINDOW_WIDTH * 2};
+const int SURFACE_HEIGHT = {WINDOW_HEIGHT * 2};
+
+// Console Updates (cells of a row compared at once when looking for what changed since the last frame, and what a
+// subcell that has never been written counts as, which no 0x00RRGGBB pixel can match)
+const int CONSOLE_DIFF_CELLS = {8};
+const Uint32 CONSOLE_UNSHOWN = {0xFF000000};
 
 // Types
 struct Texture {
@@ -42,3 +69,100 @@ struct Texture {
     int width;
     int height;
 };
+
+// 0x00RRGGBB pixels, row-major, owned by the engine rather than SDL
+struct Framebuffer {
+	std::vector<Uint32> pixels;
+	int width;
+	int height;
+};
+
+// What a frame is drawn from
+struct CameraState {
+	double x;
+	double y;
+	double theta;
+	const LightTable* lighting;
+};
+
+// What a console was last sent, so that each frame only writes the cells that changed
+struct ConsoleCache {
+	std::vector<Uint32> shown;				// Subcells each cell was last drawn from (CONSOLE_UNSHOWN for none)
+	std::vector<Uint8> overlaid;			// Cells the HUD covers, which only take their background from the view
+	std::unique_ptr<TCODConsole> hud;		// Text drawn over the view, kept from one frame to the next
+	int written;							// Cells written by the last present()
+};
+
+// Draws text over the view
+using HudPainter = void (*)(TCODConsole* console);
+
+// Rows of a column left open once a wall with a gap in it has been drawn, which is all that anything further away can
+// show through
+struct ColumnWindow {
+	double depth;							// Of the wall
+	int top;
+	int bottom;								// One past the last open row
+};
+
+// Draws columns [first, last) of a frame
+using ColumnRenderer = void (*)(Framebuffer& target, int first, int last);
+
+// How the floor and ceiling are cast
+enum class FloorMode {
+	columns,
+	rows
+};
+
+// Function Prototypes
+auto get_wall_texture_files(const char* directory) -> std::vector<std::string>;
+auto load_wall_textures(const std::vector<std::string>& files) -> int;
+auto load_sprite_textures() -> int;
+auto load_textures() -> int;
+auto prepare_visibility(const std::string& map_file) -> void;
+auto initialise(bool headless) -> int;
+auto is_frame_unchanged() -> bool;
+auto render(Framebuffer& target) -> void;
+auto select_column_renderer() -> ColumnRenderer;
+template <bool Shaded, bool FloorColumns, bool Timed> auto render_column_tile(Framebuffer& target, int first,
+	int last) -> void;
+template <bool Shaded, bool Timed> auto render_layered_tile(Framebuffer& target, int first, int last) -> void;
+auto get_wall_span(double dist, int& top) -> int;
+template <bool Shaded> auto draw_wall_rows(Uint32* column, int pitch, const RayHit& hit, const Uint8* colormap,
+	int top, int height, int first, int last) -> void;
+template <bool Shaded> auto draw_plane_rows(Uint32* column, int pitch, double dir_x, double dir_y, int level,
+	bool ceiling, int first, int last) -> void;
+auto render_floor_rows(Framebuffer& target, int first, int last) -> void;
+auto render_sprites(Framebuffer& target, int first, int last) -> void;
+auto reset_console_cache(ConsoleCache& cache) -> void;
+auto present(const Framebuffer& source, TCODConsole* console, ConsoleCache& cache) -> void;
+auto is_subcell_span_changed(const Uint32* top, const Uint32* bottom, const Uint32* shown_top,
+	const Uint32* shown_bottom, int first, int last) -> bool;
+auto write_console_cell(TCODConsole* console, const ConsoleCache& cache, int x, int y, const Uint32* top,
+	const Uint32* bottom) -> void;
+auto set_console_hud(ConsoleCache& cache, TCODConsole* console, HudPainter paint) -> void;
+auto draw_credits(TCODConsole* console) -> void;
+auto draw_profile_overlay(TCODConsole* console) -> void;
+auto interpolate_camera(double alpha) -> CameraState;
+auto set_camera(const CameraState& camera) -> void;
+auto post_camera(const CameraState& camera) -> void;
+auto render_frames() -> void;
+auto close() -> void;
+auto update_world(double dt) -> void;
+auto print_usage(const char* program) -> void;
+auto main(int argc, char* args[]) -> int;
+
+// Engine State (defined in main.cpp)
+extern GridMap world_map;
+extern double camera_x;
+extern double camera_y;
+extern double camera_theta;
+extern Framebuffer framebuffer;
+extern const LightTable* lighting;
+extern bool assets_cached;
+extern Sint64 asset_load_time;
+extern TextureAtlas sprite_atlas;
+extern std::vector<Sprite> sprites;
+extern std::unique_ptr<ThreadPool> render_pool;
+extern Traversal traversal;
+extern VisibilitySet world_visibility;
+extern FloorMode floor_mode;
@@ -0,0 +1,79 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "grid_map.hpp"
+#include "thread_pool.hpp"
+
+// Entities are circles no wider than a square, so the 3x3 hash cells around one hold everything that can touch it
+const double ENTITY_MAX_RADIUS = {0.5};
+const double SPATIAL_HASH_CELL = {2 * ENTITY_MAX_RADIUS};
+
+// Entities are moved in blocks of this many, each block on whichever thread takes it
+const int ENTITY_BLOCK = {256};
+
+// Uniform grid over the world hashed into a table of buckets, rebuilt from scratch every tick. Each bucket's entities
+// are a run of entries (from starts[bucket] to starts[bucket + 1]); different cells can share a bucket, so anything
+// found still has to be checked against where it actually is.
+struct SpatialHash {
+	std::vector<int> starts;
+	std::vector<int> entries;
+	std::vector<int> buckets;				// Bucket of each entity
+	unsigned int mask;						// Bucket count - 1 (a power of two)
+};
+
+// Circles moving over the map, one array per field. Velocities are what each entity wants to move by (squares / s);
+// walls and other entities decide where it actually gets to.
+struct Entities {
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> vel_x;
+	std::vector<double> vel_y;
+	std::vector<double> radius;
+	std::vector<double> next_x;				// Where each entity ends the tick being worked out
+	std::vector<double> next_y;
+	SpatialHash hash;
+};
+
+auto add_entity(Entities& entities, double x, double y, double radius) -> int;
+auto build_spatial_hash(SpatialHash& hash, const std::vector<double>& x, const std::vector<double>& y) -> void;
+
+// Moves a circle by (dx, dy), stopping where it would first touch a wall and sliding along it with whatever is left
+// of the move. However far it moves, it can't pass through a wall. Returns whether it touched one.
+auto sweep_circle(const GridMap& map, double& x, double& y, double radius, double dx, double dy) -> bool;
+
+// One tick: every entity is pushed out of any others it overlaps and then swept along its velocity. Each is worked
+// out from where the others were at the start of the tick, so the result is the same on any number of threads.
+auto update_entities(const GridMap& map, Entities& entities, double dt, ThreadPool* pool) -> void;
+
+inline auto get_entity_count(const Entities& entities) -> std::size_t
+{
+	return entities.x.size();
+}
+
+inline auto get_spatial_hash_cell(double position) -> int
+{
+	return static_cast<int>(std::floor(position / SPATIAL_HASH_CELL));
+}
+
+inline auto get_spatial_hash_bucket(const SpatialHash& hash, int cell_x, int cell_y) -> unsigned int
+{
+	return (static_cast<unsigned int>(cell_x) * 73856093u ^ static_cast<unsigned int>(cell_y) * 19349663u) & hash.mask;
+}
@@ -0,0 +1,89 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Stages of a frame that are timed, from reading the keyboard to flushing the console
+enum class ProfileStage {
+	frame,									// Everything but the frame cap's sleep
+	input,
+	update,									// World ticks
+	ray_walk,
+	wall_draw,
+	floor_draw,
+	sprite_draw,
+	downsample,								// Averaging a larger framebuffer down to subcells
+	console_fill,							// Glyphs and text written to the console
+	flush,
+	count
+};
+
+const int PROFILE_STAGES = {static_cast<int>(ProfileStage::count)};
+const int PROFILE_WINDOW = {60};			// Frames the rolling averages are taken over
+const std::size_t PROFILE_TRACE_EVENTS = {1 << 20};
+
+extern std::atomic<bool> profiler_enabled;
+
+inline auto get_nanoseconds() -> std::int64_t
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline auto is_profiling() -> bool
+{
+	return profiler_enabled.load(std::memory_order_relaxed);
+}
+
+auto get_profile_stage_name(ProfileStage stage) -> const char*;
+
+// Starting clears everything recorded so far. With room for any trace events, every stage recorded is also kept with
+// its thread and start and end times for save_profile_trace(). The room is allocated here, so a trace is only ever
+// started while nothing is being timed.
+auto start_profiler(std::size_t trace_events) -> void;
+auto stop_profiler() -> void;
+
+// Thread-safe and allocation-free, so render threads can record as they go
+auto record_profile(ProfileStage stage, std::int64_t started, std::int64_t ended) -> void;
+
+// Called once a frame by the thread that presents, to roll what was recorded since the last call into the averages
+auto end_profile_frame() -> void;
+
+auto get_profile_total(ProfileStage stage) -> std::int64_t;
+auto get_profile_average(ProfileStage stage) -> double;
+auto save_profile_trace(const char* file) -> bool;
+
+// Times the scope it's declared in as a stage. While the profiler is off this is a single test of a flag, and the
+// clock is never read.
+class ProfileZone {
+public:
+	explicit ProfileZone(ProfileStage stage) : stage{stage}, started{is_profiling() ? get_nanoseconds() : 0} {}
+	~ProfileZone()
+	{
+		if (started != 0)
+			record_profile(stage, started, get_nanoseconds());
+	}
+	ProfileZone(const ProfileZone&) = delete;
+	auto operator=(const ProfileZone&) -> ProfileZone& = delete;
+
+private:
+	ProfileStage stage;
+	std::int64_t started;
+};
@@ -0,0 +1,69 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "grid_map.hpp"
+#include "raycast.hpp"
+#include "thread_pool.hpp"
+
+// Rays run in blocks of this many, each block on whichever thread takes it
+const int RAY_QUERY_BLOCK = {256};
+
+// A batch of rays for the game to ask about at once (what a ray hits, or whether one point can see another), kept as
+// one array per field. Directions need not be of unit length; distances come back in multiples of them.
+struct RayQueries {
+	std::vector<double> origin_x;
+	std::vector<double> origin_y;
+	std::vector<double> dir_x;
+	std::vector<double> dir_y;
+	std::vector<double> max_dist;			// How far along the ray to look (HUGE_VAL = until it hits a wall)
+};
+
+// What each ray hit, as in RayHit but one array per field. A ray that reached its max_dist without meeting a wall
+// has wall 0.
+struct RayResults {
+	std::vector<int> wall;
+	std::vector<int> cell_x;
+	std::vector<int> cell_y;
+	std::vector<double> dist;
+	std::vector<double> hit_x;
+	std::vector<double> hit_y;
+	std::vector<int> txt_x;
+	std::vector<std::uint8_t> vertical;
+};
+
+auto clear_ray_queries(RayQueries& queries) -> void;
+auto add_ray_query(RayQueries& queries, double origin_x, double origin_y, double dir_x, double dir_y) -> void;
+auto add_sight_query(RayQueries& queries, double from_x, double from_y, double to_x, double to_y) -> void;
+
+// Casts every ray, across the pool's threads if there is one. Results are only reallocated when there are more rays
+// than last time.
+auto run_ray_queries(const GridMap& map, const RayQueries& queries, RayResults& results, ThreadPool* pool) -> void;
+
+inline auto get_ray_query_count(const RayQueries& queries) -> std::size_t
+{
+	return queries.origin_x.size();
+}
+
+// For a sight query, whether the target can be seen from where it was looked at from
+inline auto is_ray_clear(const RayResults& results, std::size_t query) -> bool
+{
+	return results.wall[query] == 0;
+}
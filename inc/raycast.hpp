@@ -0,0 +1,74 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "grid_map.hpp"
+
+// Walls are always a single 64 texel wide tile
+const int RAY_TEXTURE_SIZE = {64};
+
+// Widest gap (in squares) between two rays for a ray between them to take its hit from theirs
+const double RAY_REUSE_GAP = {0.5};
+
+// Where a ray stopped. dist is in multiples of the length of the direction passed in, so a direction whose component
+// along the view direction is 1 gives the perpendicular (fish-eye corrected) distance.
+struct RayHit {
+	int wall;								// Map value of the cell that was hit
+	int cell_x;								// Map cell that was hit (may be just outside the map)
+	int cell_y;
+	double dist;
+	double hit_x;							// World position of the hit point
+	double hit_y;
+	int txt_x;								// Texture column (0..RAY_TEXTURE_SIZE - 1)
+	bool vertical;							// Hit a wall face along a vertical grid line
+};
+
+// A wall with a gap in it that a ray went through on its way to one that fills its square, and how far along the ray
+// came out of the wall's cell
+struct RayLayer {
+	RayHit hit;
+	double exit;
+};
+
+// How rays walk the grid. All give the same hits; legacy is the original walk, intersecting each grid line with a
+// division per step, dda steps from one grid line to the next with no division inside the loop, and skipping is the
+// dda jumping across empty space using the map's clearance.
+enum class Traversal {
+	legacy,
+	dda,
+	skipping
+};
+
+auto get_traversal_name(Traversal traversal) -> const char*;
+auto cast_ray(Traversal traversal, const GridMap& map, double origin_x, double origin_y, double dir_x,
+	double dir_y) -> RayHit;
+auto cast_ray_legacy(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit;
+auto cast_ray_dda(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit;
+auto cast_ray_skipping(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit;
+
+// Skipping, but giving up once the ray is max_dist (in multiples of the direction) along. A ray that gets that far
+// without reaching a wall comes back with wall 0 and dist max_dist, and the cell and point it ended at. A ray with no
+// direction comes back at dist 0 with the cell it started in, and that cell's wall (0 if it is empty).
+auto cast_ray_limited(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y,
+	double max_dist) -> RayHit;
+
+// Skipping, going on through any walls with gaps in them to the first wall that fills its square, which is returned.
+// The first max_layers walls it went through are put in layers, nearest first, and their number returned in count.
+auto cast_ray_layers(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y,
+	RayLayer* layers, int max_layers, int& count) -> RayHit;
+auto interpolate_ray(const RayHit& before, const RayHit& after, double spread, double origin_x, double origin_y,
+	double dir_x, double dir_y, RayHit& hit) -> bool;
+auto check_traversal(const GridMap& map, int* rays, int* corners) -> int;
@@ -0,0 +1,82 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "thread_pool.hpp"
+
+// SDL objects that free themselves
+struct SurfaceDeleter {
+	auto operator()(SDL_Surface* surface) const -> void
+	{
+		SDL_FreeSurface(surface);
+	}
+};
+struct RWopsDeleter {
+	auto operator()(SDL_RWops* io) const -> void
+	{
+		SDL_RWclose(io);
+	}
+};
+using SurfaceHandle = std::unique_ptr<SDL_Surface, SurfaceDeleter>;
+using RWopsHandle = std::unique_ptr<SDL_RWops, RWopsDeleter>;
+
+// A decoded image, width * height pixels in rows with nothing between them
+struct Image {
+	const std::uint32_t* pixels;
+	int width;
+	int height;
+	std::shared_ptr<const std::uint32_t[]> block;	// The arena block the pixels are in, kept for as long as they are
+};
+
+// Owner of every decoded image. A file is decoded the first time it's asked for (in a given pixel format) and every
+// later request shares that copy. Pixels go into one arena of large blocks, so they never move once decoded, and a
+// block is freed once neither the cache nor any image in it is left; the SDL surface they were decoded from is freed
+// straight away.
+class ResourceCache {
+public:
+	ResourceCache() = default;
+	ResourceCache(const ResourceCache&) = delete;
+	auto operator=(const ResourceCache&) -> ResourceCache& = delete;
+
+	// nullptr (with the reason written out) if the file can't be decoded
+	auto load_image(const std::string& file, Uint32 format) -> std::shared_ptr<const Image>;
+
+	// As load_image() for every file, decoding them in parallel on the pool (if there is one)
+	auto load_images(const std::vector<std::string>& files, Uint32 format, ThreadPool* pool) ->
+		std::vector<std::shared_ptr<const Image>>;
+	auto get_image_count() const -> std::size_t;
+	auto get_arena_size() const -> std::size_t;
+
+private:
+	auto allocate(std::size_t pixels) -> std::uint32_t*;
+	auto store_image(const std::string& file, Uint32 format, SDL_Surface* surface) -> std::shared_ptr<const Image>;
+
+	std::vector<std::shared_ptr<std::uint32_t[]>> blocks;
+	std::size_t block_used = {0};			// Pixels handed out from the newest block
+	std::size_t block_size = {0};
+	std::size_t arena_size = {0};			// Pixels in every block
+	std::map<std::pair<std::string, Uint32>, std::shared_ptr<const Image>> images;
+};
@@ -0,0 +1,53 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <vector>
+
+#include "grid_map.hpp"
+#include "visibility.hpp"
+
+// Sprites are a single 64 texel square, standing on the floor and a square high
+const int SPRITE_TEXTURE_SIZE = {64};
+
+// Anything nearer the camera than this (in squares along the view direction) is not drawn
+const double SPRITE_NEAR_DIST = {0.1};
+
+// Sprite texels with less alpha than this are see-through
+const unsigned int SPRITE_ALPHA_CUTOFF = {0x80};
+
+// A billboard, always drawn facing the camera
+struct Sprite {
+	double x;								// World position of its centre
+	double y;
+	int texture;							// Sprite texture (in the order they were loaded)
+};
+
+// A sprite as it lands on the screen this frame
+struct SpriteView {
+	double depth;							// Distance along the view direction, as for walls
+	double left;							// Screen column of its left edge (may be off the screen)
+	double width;							// Columns across
+	int first;								// Columns it covers that are on the screen
+	int last;
+	int texture;
+};
+
+auto load_sprites(const char* file, int textures) -> std::vector<Sprite>;
+auto scatter_sprites(const GridMap& map, int count, int textures, unsigned int seed) -> std::vector<Sprite>;
+auto project_sprites(const std::vector<Sprite>& sprites, const VisibilitySet& visibility, double origin_x,
+	double origin_y, double view_cos, double view_sin, double tan_half_fov, int surface_width,
+	std::vector<SpriteView>& views) -> void;
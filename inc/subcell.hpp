@@ -0,0 +1,40 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+
+// Quadrant characters a console cell can show, each drawing its quadrants in the foreground colour and the rest in
+// the background colour (libtcod's subcell characters, plus a blank for a cell of one colour)
+enum class SubcellShape {
+	blank,
+	nw,
+	ne,
+	n,
+	sw,
+	se,
+	e,
+	diag
+};
+
+// A 2x2 block of pixels as one console cell
+struct SubcellGlyph {
+	SubcellShape shape;
+	std::uint32_t foreground;				// 0x00RRGGBB
+	std::uint32_t background;
+};
+
+auto get_subcell_glyph(const std::uint32_t* top, const std::uint32_t* bottom) -> SubcellGlyph;
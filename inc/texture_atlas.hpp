@@ -0,0 +1,61 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Square wall (or sprite) textures kept in one contiguous arena. Walls are drawn a vertical slice at a time, so each
+// texture is stored transposed (column by column) to make a slice a run of adjacent texels, and with every mip level
+// down to 1x1 so that distant walls read from a smaller level that stays in cache.
+struct TextureAtlas {
+	std::vector<std::uint32_t> texels;
+	std::vector<std::size_t> offsets;		// Start of mip level m of texture t at t * levels + m
+	int tile_size;							// Width and height of level 0 (a power of two)
+	int levels;
+	std::shared_ptr<const std::uint32_t> mapped;	// Texels used instead, when the atlas came from the asset cache
+};
+
+auto create_texture_atlas(int tile_size) -> TextureAtlas;
+auto add_atlas_texture(TextureAtlas& atlas, const std::uint32_t* pixels, int pitch) -> int;
+
+inline auto get_atlas_count(const TextureAtlas& atlas) -> int
+{
+	return static_cast<int>(atlas.offsets.size()) / atlas.levels;
+}
+
+// The smallest level that still has at least one texel per screen pixel of a slice this high
+inline auto get_atlas_level(const TextureAtlas& atlas, int height) -> int
+{
+	int level = {0};
+	while (level + 1 < atlas.levels && (atlas.tile_size >> (level + 1)) >= height)
+		level++;
+
+	return level;
+}
+
+inline auto get_atlas_texels(const TextureAtlas& atlas) -> const std::uint32_t*
+{
+	return atlas.mapped != nullptr ? atlas.mapped.get() : atlas.texels.data();
+}
+
+// Column x (0..size of level - 1) of a mip level, as a run of texels from top to bottom
+inline auto get_atlas_column(const TextureAtlas& atlas, int texture, int level, int x) -> const std::uint32_t*
+{
+	return get_atlas_texels(atlas) + atlas.offsets[texture * atlas.levels + level] + x * (atlas.tile_size >> level);
+}
@@ -0,0 +1,74 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for splitting a frame into independent pieces of work. Each call to run() hands
+// every thread (the calling one included) an equal slice of the indices; a thread that finishes its slice early steals
+// half of whatever is left in another thread's slice, so uneven work (e.g. open rooms against narrow corridors)
+// still balances out. No memory is allocated per call.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+	auto get_size() const -> unsigned int;
+
+	// Calls task(context, index) for every index in [0, count) and returns once they have all completed
+	auto run(int count, void (*task)(void*, int), void* context) -> void;
+
+	template <typename F>
+	auto parallel_for(int count, F& task) -> void
+	{
+		run(count, [](void* context, int index) { (*static_cast<F*>(context))(index); }, &task);
+	}
+
+private:
+
+	// Each thread's remaining work, packed as (end << 32 | begin) so that taking from either end is a single CAS
+	struct alignas(64) Slice {
+		std::atomic<std::uint64_t> range;
+	};
+
+	auto work_loop(unsigned int index) -> void;
+	auto drain(unsigned int index) -> void;
+	auto pop(unsigned int index, int& item) -> bool;
+	auto steal(unsigned int index) -> bool;
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<Slice[]> slices;
+	unsigned int size;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::uint64_t generation;
+	bool stopping;
+	unsigned int draining;					// Workers yet to finish their drain() of this call
+
+	std::atomic<int> remaining;
+	void (*task)(void*, int);
+	void* context;
+};
@@ -0,0 +1,62 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+// Three slots passed between one thread that writes values and one that reads them, without either ever waiting on
+// the other. The writer always has a slot of its own to fill, publishing swaps it with the slot in the middle, and the
+// reader swaps its own slot with the middle one whenever something newer has been published since it last looked.
+// Values the reader was too slow to see are simply overwritten.
+template <typename T>
+class TripleBuffer {
+public:
+	explicit TripleBuffer(const T& initial) : slots{initial, initial, initial}, back{0}, middle{1}, front{2} {}
+	TripleBuffer(const TripleBuffer&) = delete;
+	auto operator=(const TripleBuffer&) -> TripleBuffer& = delete;
+
+	// Writer: the slot to fill next
+	auto get_back() -> T&
+	{
+		return slots[back];
+	}
+
+	// Writer: hand over the slot just filled as the newest value
+	auto publish() -> void
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Reader: the newest value published since the last call, or nullptr if nothing has been
+	auto acquire() -> const T*
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+			return nullptr;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+
+		return &slots[front];
+	}
+
+private:
+	static constexpr int INDEX = {3};
+	static constexpr int FRESH = {4};			// Set on the middle slot until the reader takes it
+
+	std::array<T, 3> slots;
+	int back;
+	std::atomic<int> middle;
+	int front;
+};
@@ -0,0 +1,97 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "grid_map.hpp"
+#include "thread_pool.hpp"
+
+// Layout of a saved set, and how it's sampled; a set saved any other way is rebuilt
+const std::uint32_t VISIBILITY_VERSION = {2};
+const int VISIBILITY_ORIGINS = {4};			// Rays start from a 4x4 spread of points in each cell
+const int VISIBILITY_RAYS = {256};			// from each of which this many rays are cast, all the way round
+const int VISIBILITY_SECTORS = {16};		// Directions the reach of a cell is kept for
+const int VISIBILITY_UNBOUNDED = {255};		// Reach (in squares) that means no bound is known
+
+// Building a set costs about the square of the number of cells, so larger maps go without one
+const std::int64_t VISIBILITY_MAX_CELLS = {128 * 128};
+
+// Part of the map that can be seen from a cell: every cell in it has a bit, row by row
+struct VisibleBox {
+	std::int16_t x;
+	std::int16_t y;
+	std::int16_t width;						// 0 for a wall cell, which has no set
+	std::int16_t height;
+};
+
+// An approximate potentially visible set for every cell of a map: each cell that one of a fixed sample of rays
+// from the cell (VISIBILITY_RAYS from each of VISIBILITY_ORIGINS squared points) passes through or stops at, widened
+// by a cell all round so that anything standing in a cell next to one that's seen (a sprite half a square across,
+// say) counts as well. An opening narrow enough to fall between the sampled rays can still be missed, so a cell seen
+// only through one may be left out. Also how far the rays from the cell get in each direction.
+struct VisibilitySet {
+	int width;								// Of the map, so 0 for no set
+	int height;
+	std::vector<VisibleBox> boxes;			// For each cell, row by row from the bottom
+	std::vector<std::uint64_t> starts;		// Where each cell's bits start in words (and where the last one ends)
+	std::vector<std::uint8_t> reach;		// For each cell, squares (rounded up) rays get in each sector
+	std::vector<std::uint64_t> words;
+};
+
+// A map of more than VISIBILITY_MAX_CELLS cells gets no set (width 0)
+auto build_visibility(const GridMap& map, ThreadPool* pool) -> VisibilitySet;
+auto load_visibility(const char* file, std::uint64_t key) -> VisibilitySet;
+auto save_visibility(const char* file, std::uint64_t key, const VisibilitySet& visibility) -> bool;
+
+// Whether the set says anything in one cell could be seen from anywhere in another (as far as its rays found).
+// Without a set, or from outside the map or inside a wall, it's assumed that it could.
+inline auto is_cell_visible(const VisibilitySet& visibility, int from_x, int from_y, int to_x, int to_y) -> bool
+{
+	if (static_cast<unsigned int>(from_x) >= static_cast<unsigned int>(visibility.width) ||
+		static_cast<unsigned int>(from_y) >= static_cast<unsigned int>(visibility.height))
+		return true;
+	std::size_t from = {static_cast<std::size_t>(from_y) * visibility.width + from_x};
+	const VisibleBox& box = {visibility.boxes[from]};
+	if (box.width == 0)
+		return true;
+
+	int x = {to_x - box.x};
+	int y = {to_y - box.y};
+	if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(box.width) ||
+		static_cast<unsigned int>(y) >= static_cast<unsigned int>(box.height))
+		return false;
+	std::size_t bit = {static_cast<std::size_t>(y) * box.width + x};
+
+	return (visibility.words[visibility.starts[from] + bit / 64] >> (bit % 64)) & 1;
+}
+
+// Furthest (in squares) anything at an angle (rad) from anywhere in a cell can be seen, or HUGE_VAL if unknown
+inline auto get_visibility_reach(const VisibilitySet& visibility, int cell_x, int cell_y, double angle) -> double
+{
+	if (static_cast<unsigned int>(cell_x) >= static_cast<unsigned int>(visibility.width) ||
+		static_cast<unsigned int>(cell_y) >= static_cast<unsigned int>(visibility.height))
+		return HUGE_VAL;
+	int sector = {static_cast<int>(std::floor(angle / (2 * M_PI) * VISIBILITY_SECTORS)) % VISIBILITY_SECTORS};
+	sector += sector < 0 ? VISIBILITY_SECTORS : 0;
+	int reach = {visibility.reach[(static_cast<std::size_t>(cell_y) * visibility.width + cell_x) * VISIBILITY_SECTORS +
+		sector]};
+
+	return reach == VISIBILITY_UNBOUNDED ? HUGE_VAL : reach;
+}
@@ -0,0 +1,73 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "allocation_count.hpp"
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+
+namespace {
+
+	std::atomic<std::uint64_t> heap_allocations = {0};
+}
+
+// The program's operator new and delete are replaced by ones that count as they go. Every other form (array,
+// nothrow) ends up in these; over-aligned allocations, which only happen when the thread pool starts, are not counted.
+auto operator new(std::size_t size) -> void*
+{
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = {std::malloc(size == 0 ? 1 : size)};
+	if (memory == nullptr)
+		throw std::bad_alloc();
+
+	return memory;
+}
+
+auto operator delete(void* memory) noexcept -> void
+{
+	std::free(memory);
+}
+
+auto operator delete(void* memory, std::size_t) noexcept -> void
+{
+	std::free(memory);
+}
+
+auto is_counting_heap_allocations() -> bool
+{
+	return true;
+}
+
+auto get_heap_allocations() -> std::uint64_t
+{
+	return heap_allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+auto is_counting_heap_allocations() -> bool
+{
+	return false;
+}
+
+auto get_heap_allocations() -> std::uint64_t
+{
+	return 0;
+}
+
+#endif
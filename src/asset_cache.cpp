@@ -0,0 +1,270 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "asset_cache.hpp"
+
+namespace {
+
+	const char ASSET_CACHE_MAGIC[8] = {'R', 'A', 'Y', 'A', 'S', 'S', 'E', 'T'};
+	const std::uint64_t ASSET_CACHE_ALIGNMENT = {64};
+
+	// 64 bit FNV-1a
+	const std::uint64_t FNV_OFFSET = {0xcbf29ce484222325ULL};
+	const std::uint64_t FNV_PRIME = {0x100000001b3ULL};
+
+	struct CacheHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t atlas_count;
+		std::uint32_t image_count;
+		std::uint32_t unused;
+		std::uint64_t key;
+	};
+
+	struct AtlasRecord {
+		std::int32_t tile_size;
+		std::int32_t levels;
+		std::uint64_t offset_count;
+		std::uint64_t texel_count;
+		std::uint64_t offsets_at;				// Bytes from the start of the file
+		std::uint64_t texels_at;
+	};
+
+	struct ImageRecord {
+		std::int32_t width;
+		std::int32_t height;
+		std::uint64_t pixels_at;
+	};
+
+	auto add_to_hash(std::uint64_t hash, const void* data, std::size_t size) -> std::uint64_t
+	{
+		const std::uint8_t* bytes = {static_cast<const std::uint8_t*>(data)};
+		for (std::size_t i = 0; i < size; i++)
+			hash = (hash ^ bytes[i]) * FNV_PRIME;
+
+		return hash;
+	}
+
+	auto align(std::uint64_t at) -> std::uint64_t
+	{
+		return (at + ASSET_CACHE_ALIGNMENT - 1) / ASSET_CACHE_ALIGNMENT * ASSET_CACHE_ALIGNMENT;
+	}
+
+	// The whole file, read-only, for as long as anything holds on to it (nullptr if it can't be opened)
+	auto map_file(const char* file, std::size_t& size) -> std::shared_ptr<const std::uint8_t>
+	{
+#if defined(__unix__) || defined(__APPLE__)
+		int fd = {open(file, O_RDONLY)};
+		if (fd < 0)
+			return nullptr;
+		struct stat info = {};
+		void* mapped = {MAP_FAILED};
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			size = static_cast<std::size_t>(info.st_size);
+			mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (mapped == MAP_FAILED)
+			return nullptr;
+
+		std::size_t length = {size};
+		return std::shared_ptr<const std::uint8_t>(static_cast<const std::uint8_t*>(mapped),
+			[length](const std::uint8_t* start) { munmap(const_cast<std::uint8_t*>(start), length); });
+#else
+		// No mapping, so read it in instead
+		std::ifstream in(file, std::ios::binary);
+		if (!in)
+			return nullptr;
+		std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		size = contents.size();
+		std::shared_ptr<std::uint8_t> copy(new std::uint8_t[size], std::default_delete<std::uint8_t[]>());
+		std::memcpy(copy.get(), contents.data(), size);
+
+		return copy;
+#endif
+	}
+
+	// Whether count things of type T starting at a byte offset lie within the file and are aligned for T
+	template <typename T>
+	auto is_in_file(std::uint64_t at, std::uint64_t count, std::size_t size) -> bool
+	{
+		return at % alignof(T) == 0 && at <= size && count <= (size - at) / sizeof(T);
+	}
+
+	auto write_padding(std::ofstream& out, std::uint64_t& at) -> void
+	{
+		const char zeros[ASSET_CACHE_ALIGNMENT] = {};
+		std::uint64_t aligned = {align(at)};
+		out.write(zeros, static_cast<std::streamsize>(aligned - at));
+		at = aligned;
+	}
+}
+
+auto get_asset_key(const std::vector<std::string>& files, std::uint64_t settings) -> std::uint64_t
+{
+	// The name and contents of every file the assets are built from, plus whatever settings they're built with
+	std::uint64_t hash = {add_to_hash(FNV_OFFSET, &settings, sizeof(settings))};
+	for (const std::string& file : files) {
+		hash = add_to_hash(hash, file.c_str(), file.size() + 1);
+		std::ifstream in(file, std::ios::binary);
+		std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		std::uint64_t size = {contents.size()};
+		hash = add_to_hash(hash, &size, sizeof(size));
+		hash = add_to_hash(hash, contents.data(), contents.size());
+	}
+
+	return hash;
+}
+
+auto load_asset_cache(const char* file, std::uint64_t key) -> AssetPack
+{
+	// A missing, damaged or stale cache is the same as none at all, so nothing is reported
+	std::size_t size = {0};
+	std::shared_ptr<const std::uint8_t> mapping = {map_file(file, size)};
+	if (mapping == nullptr || size < sizeof(CacheHeader))
+		return {};
+
+	CacheHeader header = {};
+	std::memcpy(&header, mapping.get(), sizeof(header));
+	if (std::memcmp(header.magic, ASSET_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != ASSET_CACHE_VERSION || header.key != key)
+		return {};
+
+	std::uint64_t at = {sizeof(CacheHeader)};
+	if (!is_in_file<AtlasRecord>(at, header.atlas_count, size))
+		return {};
+	const AtlasRecord* atlas_records = {reinterpret_cast<const AtlasRecord*>(mapping.get() + at)};
+	at += header.atlas_count * sizeof(AtlasRecord);
+	if (!is_in_file<ImageRecord>(at, header.image_count, size))
+		return {};
+	const ImageRecord* image_records = {reinterpret_cast<const ImageRecord*>(mapping.get() + at)};
+
+	AssetPack pack = {};
+	for (std::uint32_t i = 0; i < header.atlas_count; i++) {
+		const AtlasRecord& record = {atlas_records[i]};
+		TextureAtlas atlas = {create_texture_atlas(record.tile_size > 0 ? record.tile_size : 1)};
+		if (record.levels != atlas.levels || record.offset_count % atlas.levels != 0 ||
+			!is_in_file<std::uint64_t>(record.offsets_at, record.offset_count, size) ||
+			!is_in_file<std::uint32_t>(record.texels_at, record.texel_count, size))
+			return {};
+
+		// Every mip level has to lie within the texels
+		const std::uint64_t* offsets = {reinterpret_cast<const std::uint64_t*>(mapping.get() + record.offsets_at)};
+		for (std::uint64_t j = 0; j < record.offset_count; j++) {
+			std::uint64_t level_size = {static_cast<std::uint64_t>(atlas.tile_size >> (j % atlas.levels))};
+			if (offsets[j] > record.texel_count || level_size * level_size > record.texel_count - offsets[j])
+				return {};
+			atlas.offsets.push_back(static_cast<std::size_t>(offsets[j]));
+		}
+		atlas.mapped = std::shared_ptr<const std::uint32_t>(mapping,
+			reinterpret_cast<const std::uint32_t*>(mapping.get() + record.texels_at));
+		pack.atlases.push_back(std::move(atlas));
+	}
+	for (std::uint32_t i = 0; i < header.image_count; i++) {
+		const ImageRecord& record = {image_records[i]};
+		if (record.width <= 0 || record.height <= 0 || !is_in_file<std::uint32_t>(record.pixels_at,
+			static_cast<std::uint64_t>(record.width) * record.height, size))
+			return {};
+
+		const std::uint32_t* pixels = {reinterpret_cast<const std::uint32_t*>(mapping.get() + record.pixels_at)};
+		pack.images.push_back(std::make_shared<const Image>(Image{pixels, record.width, record.height,
+			std::shared_ptr<const std::uint32_t[]>(mapping, pixels)}));
+	}
+
+	return pack;
+}
+
+auto save_asset_cache(const char* file, std::uint64_t key, const std::vector<const TextureAtlas*>& atlases,
+	const std::vector<const Image*>& images) -> bool
+{
+	// Lay everything out first, so the records can be written before what they point to
+	CacheHeader header = {};
+	std::memcpy(header.magic, ASSET_CACHE_MAGIC, sizeof(header.magic));
+	header.version = ASSET_CACHE_VERSION;
+	header.atlas_count = static_cast<std::uint32_t>(atlases.size());
+	header.image_count = static_cast<std::uint32_t>(images.size());
+	header.key = key;
+
+	std::uint64_t at = {sizeof(CacheHeader) + atlases.size() * sizeof(AtlasRecord) + images.size() *
+		sizeof(ImageRecord)};
+	std::vector<AtlasRecord> atlas_records = {};
+	for (const TextureAtlas* atlas : atlases) {
+		AtlasRecord record = {atlas->tile_size, atlas->levels, atlas->offsets.size(), atlas->texels.size(), 0, 0};
+		record.offsets_at = align(at);
+		record.texels_at = align(record.offsets_at + record.offset_count * sizeof(std::uint64_t));
+		at = record.texels_at + record.texel_count * sizeof(std::uint32_t);
+		atlas_records.push_back(record);
+	}
+	std::vector<ImageRecord> image_records = {};
+	for (const Image* image : images) {
+		ImageRecord record = {image->width, image->height, align(at)};
+		at = record.pixels_at + static_cast<std::uint64_t>(image->width) * image->height * sizeof(std::uint32_t);
+		image_records.push_back(record);
+	}
+
+	// Written alongside and then moved over the old one, so a cache is never left half written
+	std::filesystem::path path = {file};
+	std::filesystem::path written = {path.string() + ".tmp"};
+	std::error_code error = {};
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), error);
+	std::ofstream out(written, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cout << "Asset cache " << file << " could not be written!" << std::endl;
+		return false;
+	}
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(atlas_records.data()), atlas_records.size() * sizeof(AtlasRecord));
+	out.write(reinterpret_cast<const char*>(image_records.data()), image_records.size() * sizeof(ImageRecord));
+	at = sizeof(CacheHeader) + atlases.size() * sizeof(AtlasRecord) + images.size() * sizeof(ImageRecord);
+	for (const TextureAtlas* atlas : atlases) {
+		std::vector<std::uint64_t> offsets(atlas->offsets.begin(), atlas->offsets.end());
+		write_padding(out, at);
+		out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(std::uint64_t));
+		at += offsets.size() * sizeof(std::uint64_t);
+		write_padding(out, at);
+		out.write(reinterpret_cast<const char*>(atlas->texels.data()), atlas->texels.size() * sizeof(std::uint32_t));
+		at += atlas->texels.size() * sizeof(std::uint32_t);
+	}
+	for (const Image* image : images) {
+		write_padding(out, at);
+		std::size_t bytes = {static_cast<std::size_t>(image->width) * image->height * sizeof(std::uint32_t)};
+		out.write(reinterpret_cast<const char*>(image->pixels), static_cast<std::streamsize>(bytes));
+		at += bytes;
+	}
+	out.close();
+	if (!out) {
+		std::cout << "Asset cache " << file << " could not be written!" << std::endl;
+		std::filesystem::remove(written, error);
+		return false;
+	}
+	std::filesystem::rename(written, path, error);
+
+	return !error;
+}
@@ -0,0 +1,403 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "main.hpp"
+
+namespace {
+
+	// A lap of the world map through the middle of its corridors and rooms
+	const double CAMERA_PATH[][2] = {
+		{1.5, 1.5}, {4.5, 1.5}, {4.5, 3.5}, {7.5, 3.5}, {7.5, 4.5}, {9.5, 4.5}, {9.5, 3.5}, {12.5, 3.5},
+		{12.5, 2.5}, {16.5, 2.5}, {16.5, 8.5}, {12.5, 8.5}, {12.5, 6.5}, {11.5, 6.5}, {11.5, 5.5}, {9.5, 5.5},
+		{9.5, 4.5}, {7.5, 4.5}, {7.5, 8.5}, {7.5, 3.5}, {5.5, 3.5}, {5.5, 6.5}, {4.5, 6.5}, {4.5, 8.5},
+		{1.5, 8.5}, {4.5, 8.5}, {4.5, 6.5}, {5.5, 6.5}, {5.5, 3.5}, {1.5, 3.5}, {1.5, 1.5}
+	};
+	const int CAMERA_POINTS = {sizeof(CAMERA_PATH) / sizeof(CAMERA_PATH[0])};
+	const double CAMERA_STEP = {0.05};			// squares per frame (3 squares / s at 60 fps)
+	const double CAMERA_SWAY = {0.6};			// rad either side of the direction of travel
+
+	// Pose along the path after a distance, facing the way it's going while looking from side to side
+	auto get_camera(double distance, int frame, double& x, double& y, double& angle) -> void
+	{
+		int point = {0};
+		while (true) {
+			const double* from = {CAMERA_PATH[point]};
+			const double* to = {CAMERA_PATH[(point + 1) % CAMERA_POINTS]};
+			double length = {std::hypot(to[0] - from[0], to[1] - from[1])};
+			if (distance <= length || length == 0) {
+				double t = {length > 0 ? distance / length : 0};
+				x = from[0] + (to[0] - from[0]) * t;
+				y = from[1] + (to[1] - from[1]) * t;
+				angle = std::atan2(to[1] - from[1], to[0] - from[0]) + CAMERA_SWAY * std::sin(frame * 0.05);
+				return;
+			}
+			distance -= length;
+			point = (point + 1) % CAMERA_POINTS;
+		}
+	}
+
+	auto get_path_length() -> double
+	{
+		double length = {0};
+		for (int point = 0; point + 1 < CAMERA_POINTS; point++)
+			length += std::hypot(CAMERA_PATH[point + 1][0] - CAMERA_PATH[point][0],
+				CAMERA_PATH[point + 1][1] - CAMERA_PATH[point][1]);
+
+		return length;
+	}
+
+	// Time (ns) during which both stages were running, from the start and end of every run of each
+	auto get_overlap(const std::vector<std::pair<Sint64, Sint64>>& first,
+		const std::vector<std::pair<Sint64, Sint64>>& second) -> Sint64
+	{
+		Sint64 overlap = {0};
+		std::size_t j = {0};
+		for (const std::pair<Sint64, Sint64>& run : first) {
+			while (j < second.size() && second[j].second <= run.first)
+				j++;
+			for (std::size_t k = j; k < second.size() && second[k].first < run.second; k++)
+				overlap += std::min(run.second, second[k].second) - std::max(run.first, second[k].first);
+		}
+
+		return overlap;
+	}
+
+	// Render every frame of the lap on a thread of its own while this one presents the newest finished frame, as the
+	// demo does. Returns the number of frames presented.
+	auto run_pipeline(int frames, int offset_x, int offset_y, TCODConsole* console, ConsoleCache& cache,
+		std::vector<double>& frame_times, Sint64& present_time, Sint64& overlap, Sint64& cells_written,
+		std::uint64_t& warm_allocations) -> int
+	{
+		TripleBuffer<Framebuffer> buffers(framebuffer);
+		std::vector<std::pair<Sint64, Sint64>> rendering(frames);
+		std::vector<std::pair<Sint64, Sint64>> presenting = {};
+		presenting.reserve(frames);
+		std::atomic<bool> finished = {false};
+
+		std::thread renderer([&]() {
+			for (int frame = 0; frame < frames; frame++) {
+				get_camera(frame * CAMERA_STEP, frame, camera_x, camera_y, camera_theta);
+				camera_x += offset_x;
+				camera_y += offset_y;
+
+				Sint64 started = {get_nanoseconds()};
+				render(buffers.get_back());
+				buffers.publish();
+				rendering[frame] = {started, get_nanoseconds()};
+				record_profile(ProfileStage::frame, started, rendering[frame].second);
+				frame_times[frame] = (rendering[frame].second - started) / 1e6;
+				if (frame == 0)
+					warm_allocations = get_heap_allocations();
+			}
+			finished.store(true, std::memory_order_release);
+		});
+
+		// Once the renderer has finished, whatever it published last is the final frame
+		while (true) {
+			bool last = {finished.load(std::memory_order_acquire)};
+			const Framebuffer* frame = {buffers.acquire()};
+			if (frame != nullptr) {
+				Sint64 started = {get_nanoseconds()};
+				present(*frame, console, cache);
+				presenting.push_back({started, get_nanoseconds()});
+				present_time += presenting.back().second - started;
+				cells_written += cache.written;
+			} else if (last)
+				break;
+			else
+				std::this_thread::yield();
+		}
+		renderer.join();
+		overlap = get_overlap(presenting, rendering);
+
+		return static_cast<int>(presenting.size());
+	}
+
+	// Casts the queries a few times over on the pool and prints how quickly, returning the number of rays whose results
+	// differ from casting each one on its own
+	auto time_ray_queries(const char* name, const RayQueries& queries, RayResults& results, ThreadPool* pool) -> int
+	{
+		const int passes = {10};
+		Sint64 started = {get_nanoseconds()};
+		for (int pass = 0; pass < passes; pass++)
+			run_ray_queries(world_map, queries, results, pool);
+		double seconds = {(get_nanoseconds() - started) / 1e9};
+
+		int mismatches = {0};
+		int clear = {0};
+		std::size_t count = {get_ray_query_count(queries)};
+		for (std::size_t i = 0; i < count; i++) {
+			RayHit hit = {cast_ray_skipping(world_map, queries.origin_x[i], queries.origin_y[i], queries.dir_x[i],
+				queries.dir_y[i])};
+			bool reached = {hit.wall == 0 || hit.dist >= queries.max_dist[i]};
+			if (reached != is_ray_clear(results, i) || (!reached && (hit.wall != results.wall[i] ||
+				hit.cell_x != results.cell_x[i] || hit.cell_y != results.cell_y[i] || hit.dist != results.dist[i] ||
+				hit.txt_x != results.txt_x[i])))
+				mismatches++;
+
+			// A ray with no direction has to stay where it started
+			else if (queries.dir_x[i] == 0 && queries.dir_y[i] == 0 && (results.dist[i] != 0 ||
+				results.cell_x[i] != std::floor(queries.origin_x[i]) ||
+				results.cell_y[i] != std::floor(queries.origin_y[i])))
+				mismatches++;
+			clear += is_ray_clear(results, i);
+		}
+		std::cout << name << ": " << count * passes / seconds / 1e6 << " Mrays/s, " << 100.0 * clear / count <<
+			"% clear, " << mismatches << " mismatches" << std::endl;
+
+		return mismatches;
+	}
+
+	// Entities that went through a wall on the way from where they were, or ended up overlapping one
+	auto count_wall_violations(const Entities& entities, const std::vector<double>& from_x,
+		const std::vector<double>& from_y) -> int
+	{
+		int violations = {0};
+		for (std::size_t i = 0; i < get_entity_count(entities); i++) {
+			double x = {entities.x[i]};
+			double y = {entities.y[i]};
+			bool through = {(x != from_x[i] || y != from_y[i]) &&
+				cast_ray_limited(world_map, from_x[i], from_y[i], x - from_x[i], y - from_y[i], 1).wall != 0};
+			bool inside = {false};
+			double radius = {entities.radius[i] - 1e-6};
+			for (int cell_y = std::floor(y - radius); cell_y <= std::floor(y + radius); cell_y++)
+				for (int cell_x = std::floor(x - radius); cell_x <= std::floor(x + radius); cell_x++)
+					inside = inside || (get_grid_cell(world_map, cell_x, cell_y) != 0 &&
+						std::hypot(x - std::clamp(x, 1.0 * cell_x, cell_x + 1.0),
+						y - std::clamp(y, 1.0 * cell_y, cell_y + 1.0)) < radius);
+			violations += through || inside;
+		}
+
+		return violations;
+	}
+
+	auto get_percentile(const std::vector<double>& sorted, double percentile) -> double
+	{
+		std::size_t index = {static_cast<std::size_t>(percentile * (sorted.size() - 1) + 0.5)};
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+}
+
+auto run_benchmark(int frames, bool with_present, int map_size, bool pipelined, int sprite_count,
+	const char* trace_file) -> int
+{
+	// By default, one lap of the path
+	if (frames <= 0)
+		frames = static_cast<int>(get_path_length() / CAMERA_STEP);
+
+	// Instead of the map's own sprites, as many as asked for scattered over the world map (the same ones every run)
+	if (sprite_count > 0)
+		sprites = scatter_sprites(world_map, sprite_count, get_atlas_count(sprite_atlas), 1);
+
+	// On a larger map made of copies of the world map the lap goes round the copy nearest the middle, so the frames
+	// are the same as on the world map and any difference in time is down to the size of the map. The sprites move
+	// to that copy with it. The visible sets only fit the world map, so none are used.
+	int offset_x = {0};
+	int offset_y = {0};
+	if (map_size > 0) {
+		map_size = std::max({map_size, world_map.width, world_map.height});
+		offset_x = map_size / 2 / world_map.width * world_map.width;
+		offset_y = map_size / 2 / world_map.height * world_map.height;
+		world_map = tile_grid_map(world_map, map_size, map_size);
+		world_visibility = {};
+		for (Sprite& sprite : sprites) {
+			sprite.x += offset_x;
+			sprite.y += offset_y;
+		}
+	}
+
+	// Presenting goes to a console of the window's size that is never shown, starting from nothing shown
+	std::unique_ptr<TCODConsole> console = {};
+	ConsoleCache cache = {};
+	with_present = with_present || pipelined;
+	if (with_present) {
+		console = std::make_unique<TCODConsole>(WINDOW_WIDTH, WINDOW_HEIGHT);
+		reset_console_cache(cache);
+	}
+
+	// The stages are timed by the profiler, which also keeps a trace of every frame if asked for one
+	start_profiler(trace_file != nullptr ? PROFILE_TRACE_EVENTS : 0);
+	std::vector<double> frame_times(frames);
+	Sint64 present_time = {0};
+	Sint64 overlap = {0};
+	Sint64 cells_written = {0};
+	int presented = {with_present ? frames : 0};
+	std::uint64_t warm_allocations = {0};
+	Sint64 total_started = {get_nanoseconds()};
+	if (pipelined)
+		presented = run_pipeline(frames, offset_x, offset_y, console.get(), cache, frame_times, present_time, overlap,
+			cells_written, warm_allocations);
+	for (int frame = 0; frame < frames && !pipelined; frame++) {
+		get_camera(frame * CAMERA_STEP, frame, camera_x, camera_y, camera_theta);
+		camera_x += offset_x;
+		camera_y += offset_y;
+
+		Sint64 started = {get_nanoseconds()};
+		render(framebuffer);
+		if (with_present) {
+			Sint64 rendered = {get_nanoseconds()};
+			present(framebuffer, console.get(), cache);
+			present_time += get_nanoseconds() - rendered;
+			cells_written += cache.written;
+		}
+		Sint64 ended = {get_nanoseconds()};
+		record_profile(ProfileStage::frame, started, ended);
+		frame_times[frame] = (ended - started) / 1e6;
+		if (frame == 0)
+			warm_allocations = get_heap_allocations();
+	}
+	double total = {(get_nanoseconds() - total_started) / 1e9};
+
+	// Once the first frame has sized everything, a frame should never touch the heap
+	std::uint64_t allocations = {get_heap_allocations() - warm_allocations};
+	stop_profiler();
+
+	// Report
+	std::vector<double> sorted = {frame_times};
+	std::sort(sorted.begin(), sorted.end());
+	double pixels = {1.0 * frames * framebuffer.width * framebuffer.height};
+	std::cout << "Benchmark: " << frames << " frames at " << framebuffer.width << "x" << framebuffer.height <<
+		" on a " << world_map.width << "x" << world_map.height << " map with " << sprites.size() << " sprites, " <<
+		(render_pool != nullptr ? render_pool->get_size() : 1) << " render thread(s), " <<
+		get_traversal_name(traversal) << " traversal, " << (floor_mode == FloorMode::rows ? "row" : "column") <<
+		" floor casting, " << get_floor_kernel_name(get_floor_kernel()) << " floor kernel, " <<
+		lighting->profile.name << " lighting" << (lighting->shaded ? "" : " (unshaded walls)") <<
+		(world_visibility.width > 0 ? ", PVS" : "") << (world_map.layered ? ", layered walls" : "") << std::endl;
+	std::cout << "Textures " << (assets_cached ? "mapped from the asset cache" : "decoded") << " in " <<
+		asset_load_time / 1e6 << " ms" << std::endl;
+	std::cout << "Stages (thread-ms/frame): ray walk " << get_profile_total(ProfileStage::ray_walk) / 1e6 / frames <<
+		", wall draw " << get_profile_total(ProfileStage::wall_draw) / 1e6 / frames << ", floor/ceiling " <<
+		get_profile_total(ProfileStage::floor_draw) / 1e6 / frames << ", sprites " <<
+		get_profile_total(ProfileStage::sprite_draw) / 1e6 / frames;
+	if (with_present)
+		std::cout << ", presentation " << present_time / 1e6 / std::max(presented, 1);
+	std::cout << std::endl;
+	if (with_present)
+		std::cout << "Console: " << 1.0 * cells_written / std::max(presented, 1) << " of " <<
+			(WINDOW_WIDTH - 1) * (WINDOW_HEIGHT - 1) << " cells written per frame presented" << std::endl;
+	if (pipelined)
+		std::cout << "Pipeline: " << frames << " frames rendered, " << presented << " presented, stages overlapping " <<
+			"for " << 100.0 * overlap / std::max<Sint64>(present_time, 1) << "% of presentation time" << std::endl;
+	std::cout << (pipelined ? "Render time (ms): min " : "Frame time (ms): min ") << sorted.front() << ", median " <<
+		get_percentile(sorted, 0.5) << ", p99 " << get_percentile(sorted, 0.99) << ", max " << sorted.back() <<
+		std::endl;
+	std::cout << "Throughput: " << frames / total << " frames/s, " << pixels / total / 1e6 << " Mpixels/s";
+	if (pipelined)
+		std::cout << ", " << presented / total << " frames/s presented";
+	std::cout << std::endl;
+	if (is_counting_heap_allocations())
+		std::cout << "Heap allocations: " << allocations << " in the " << frames - 1 << " frames after the first" <<
+			std::endl;
+	else
+		std::cout << "Heap allocations: not counted (build with COUNT_HEAP_ALLOCATIONS defined)" << std::endl;
+	if (trace_file != nullptr)
+		save_profile_trace(trace_file);
+
+	return allocations == 0 ? 0 : 1;
+}
+
+auto run_query_benchmark(int rays, int map_size, unsigned int threads) -> int
+{
+	if (map_size > 0)
+		world_map = tile_grid_map(world_map, std::max({map_size, world_map.width, world_map.height}),
+			std::max({map_size, world_map.width, world_map.height}));
+	std::unique_ptr<ThreadPool> pool = {};
+	if (threads > 1)
+		pool = std::make_unique<ThreadPool>(threads);
+
+	// Random points in empty cells (the same every run), looking in random directions until they hit a wall, and
+	// asking whether each can see the next
+	std::vector<Sprite> points = {scatter_sprites(world_map, rays + 1, 1, 1)};
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+	RayQueries hits = {};
+	RayQueries sights = {};
+	for (int i = 0; i < rays; i++) {
+		double direction = {angle(random)};
+		add_ray_query(hits, points[i].x, points[i].y, std::cos(direction), std::sin(direction));
+		add_sight_query(sights, points[i].x, points[i].y, points[i + 1].x, points[i + 1].y);
+	}
+
+	// Along with a ray with no direction, and a point looking at itself
+	add_ray_query(hits, points[rays].x, points[rays].y, 0, 0);
+	add_sight_query(sights, points[rays].x, points[rays].y, points[rays].x, points[rays].y);
+
+	RayResults results = {};
+	std::cout << "Ray queries: " << rays << " rays on a " << world_map.width << "x" << world_map.height << " map, " <<
+		(pool != nullptr ? pool->get_size() : 1) << " thread(s)" << std::endl;
+	int mismatches = {time_ray_queries("Wall hits", hits, results, pool.get())};
+	mismatches += time_ray_queries("Line of sight", sights, results, pool.get());
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+auto run_entity_benchmark(int count, int map_size, unsigned int threads) -> int
+{
+	const int ticks = {600};
+	const double tick_length = {1.0 / 60};	// s, as in the demo
+	const int turn_ticks = {60};			// Ticks between each entity picking a new direction
+	const double radius = {0.2};			// so that none start in a wall
+	const double max_speed = {12};			// squares / s
+	const double fast_speed = {120};		// 2 squares a tick, for the one in a hundred that would otherwise tunnel
+
+	// The world map alone would have ten thousand entities packed a hundred to a cell
+	map_size = std::max({map_size > 0 ? map_size : 256, world_map.width, world_map.height});
+	world_map = tile_grid_map(world_map, map_size, map_size);
+	std::unique_ptr<ThreadPool> pool = {};
+	if (threads > 1)
+		pool = std::make_unique<ThreadPool>(threads);
+
+	// Scattered over the empty cells and wandering about (the same every run)
+	Entities entities = {};
+	for (const Sprite& point : scatter_sprites(world_map, count, 1, 1))
+		add_entity(entities, point.x, point.y, radius);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+	std::uniform_real_distribution<double> speed(0, max_speed);
+
+	std::vector<double> from_x(count);
+	std::vector<double> from_y(count);
+	std::vector<double> tick_times(ticks);
+	int violations = {0};
+	for (int tick = 0; tick < ticks; tick++) {
+		if (tick % turn_ticks == 0) {
+			for (int i = 0; i < count; i++) {
+				double direction = {angle(random)};
+				double moving = {i % 100 == 0 ? fast_speed : speed(random)};
+				entities.vel_x[i] = std::cos(direction) * moving;
+				entities.vel_y[i] = std::sin(direction) * moving;
+			}
+		}
+		from_x = entities.x;
+		from_y = entities.y;
+
+		Sint64 started = {get_nanoseconds()};
+		update_entities(world_map, entities, tick_length, pool.get());
+		tick_times[tick] = (get_nanoseconds() - started) / 1e6;
+		violations += count_wall_violations(entities, from_x, from_y);
+	}
+
+	std::vector<double> sorted = {tick_times};
+	std::sort(sorted.begin(), sorted.end());
+	double total = {std::accumulate(tick_times.begin(), tick_times.end(), 0.0) / 1e3};
+	std::cout << "Entities: " << count << " on a " << world_map.width << "x" << world_map.height << " map for " <<
+		ticks << " ticks, " << (pool != nullptr ? pool->get_size() : 1) << " thread(s)" << std::endl;
+	std::cout << "Tick time (ms): min " << sorted.front() << ", median " << get_percentile(sorted, 0.5) << ", p99 " <<
+		get_percentile(sorted, 0.99) << ", max " << sorted.back() << std::endl;
+	std::cout << "Throughput: " << count * ticks / total / 1e6 << " M entity moves/s" << std::endl;
+	std::cout << "Wall violations: " << violations << std::endl;
+
+	return violations == 0 ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cmath>
+#include <vector>
+
+#include "floor_kernel.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLOOR_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+	using DrawSpan = void (*)(const FloorSpan&, int);
+
+	auto floor_slope(const FloorSpan& span) -> float
+	{
+		return (span.darkness_alpha - 255.0f) / (span.darkest_dist - span.min_dist);
+	}
+
+	// Every kernel must round a product to float before adding to it. With FMA enabled (e.g. -march=native) GCC will
+	// otherwise fuse the two, intrinsics included, and only in some of the kernels.
+	template <typename T>
+	auto rounded(T value) -> T
+	{
+#ifdef FLOOR_KERNEL_X86
+		asm("" : "+x"(value));
+		return value;
+#else
+		volatile T result = {value};
+		return result;
+#endif
+	}
+
+	auto product(float a, float b) -> float
+	{
+		return rounded(a * b);
+	}
+
+	// Rows [first, span.rows) one at a time, also used for the leftover rows of the vector kernels
+	auto draw_span_scalar(const FloorSpan& span, int first) -> void
+	{
+		const float slope = {floor_slope(span)};
+		for (int j = first; j < span.rows; j++) {
+			float rev_corr = {span.surface_height / (span.surface_height - 2.0f * j)};
+			float real_x = {span.origin_x + product(span.dir_x, rev_corr)};
+			float real_y = {span.origin_y + product(span.dir_y, rev_corr)};
+			int tx = {static_cast<int>((real_x - std::floor(real_x)) * FLOOR_TEXTURE_SIZE) & (FLOOR_TEXTURE_SIZE - 1)};
+			int ty = {static_cast<int>((real_y - std::floor(real_y)) * FLOOR_TEXTURE_SIZE) & (FLOOR_TEXTURE_SIZE - 1)};
+
+			std::uint32_t dark = {255};
+			if (rev_corr > span.darkest_dist)
+				dark = static_cast<std::uint32_t>(span.darkness_alpha);
+			else if (rev_corr > span.min_dist) // interpolate
+				dark = static_cast<std::uint32_t>(product(rev_corr - span.min_dist, slope) + 255.0f);
+
+			std::uint32_t floor_pixel = {span.floor_texels[FLOOR_TEXTURE_SIZE * ty + tx]};
+			std::uint32_t ceiling_pixel = {span.ceiling_texels[FLOOR_TEXTURE_SIZE * ty + tx]};
+			span.floor_out[-j * span.pitch] = ((((floor_pixel >> 16) & 0xFF) * dark / 255) << 16) |
+				((((floor_pixel >> 8) & 0xFF) * dark / 255) << 8) | ((floor_pixel & 0xFF) * dark / 255);
+			span.ceiling_out[j * span.pitch] = ((((ceiling_pixel >> 16) & 0xFF) * dark / 255) << 16) |
+				((((ceiling_pixel >> 8) & 0xFF) * dark / 255) << 8) | ((ceiling_pixel & 0xFF) * dark / 255);
+		}
+	}
+
+#ifdef FLOOR_KERNEL_X86
+
+	// Floor of positive and negative values (SSE2 only truncates)
+	auto floor_sse2(__m128 value) -> __m128
+	{
+		__m128 truncated = {_mm_cvtepi32_ps(_mm_cvttps_epi32(value))};
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, value), _mm_set1_ps(1.0f)));
+	}
+
+	// Multiplies 4 packed 0x00RRGGBB pixels by 4 darkness values, dividing by 255 exactly
+	auto shade_sse2(__m128i texels, __m128i dark) -> __m128i
+	{
+		const __m128i zero = {_mm_setzero_si128()};
+		const __m128i one = {_mm_set1_epi16(1)};
+		__m128i dark_16 = {_mm_packs_epi32(dark, dark)};
+		dark_16 = _mm_unpacklo_epi16(dark_16, dark_16);
+		__m128i dark_lo = {_mm_unpacklo_epi32(dark_16, dark_16)};
+		__m128i dark_hi = {_mm_unpackhi_epi32(dark_16, dark_16)};
+
+		__m128i lo = {_mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), dark_lo)};
+		__m128i hi = {_mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), dark_hi)};
+		lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+
+		return _mm_packus_epi16(lo, hi);
+	}
+
+	auto draw_floor_span_sse2(const FloorSpan& span, int first) -> void
+	{
+		const __m128 height = {_mm_set1_ps(span.surface_height)};
+		const __m128 min_dist = {_mm_set1_ps(span.min_dist)};
+		const __m128 darkest_dist = {_mm_set1_ps(span.darkest_dist)};
+		const __m128 slope = {_mm_set1_ps(floor_slope(span))};
+		const __m128 full = {_mm_set1_ps(255.0f)};
+		const __m128 size = {_mm_set1_ps(static_cast<float>(FLOOR_TEXTURE_SIZE))};
+		const __m128i mask = {_mm_set1_epi32(FLOOR_TEXTURE_SIZE - 1)};
+		const __m128i alpha = {_mm_set1_epi32(static_cast<int>(span.darkness_alpha))};
+		const __m128i bright = {_mm_set1_epi32(255)};
+
+		alignas(16) std::int32_t index[4];
+		alignas(16) std::uint32_t floor_pixels[4];
+		alignas(16) std::uint32_t ceiling_pixels[4];
+
+		int j = {first};
+		for (; j + 4 <= span.rows; j += 4) {
+			__m128 row = {_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(j), _mm_set_epi32(3, 2, 1, 0)))};
+			__m128 rev_corr = {_mm_div_ps(height, _mm_sub_ps(height, _mm_add_ps(row, row)))};
+			__m128 real_x = {_mm_add_ps(_mm_set1_ps(span.origin_x),
+				rounded(_mm_mul_ps(_mm_set1_ps(span.dir_x), rev_corr)))};
+			__m128 real_y = {_mm_add_ps(_mm_set1_ps(span.origin_y),
+				rounded(_mm_mul_ps(_mm_set1_ps(span.dir_y), rev_corr)))};
+			__m128i tx = {_mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(real_x, floor_sse2(real_x)), size)),
+				mask)};
+			__m128i ty = {_mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(real_y, floor_sse2(real_y)), size)),
+				mask)};
+			_mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_add_epi32(_mm_slli_epi32(ty, 6), tx));
+
+			// Blend interpolated, darkest and full brightness by comparison masks
+			__m128i dark = {_mm_cvttps_epi32(_mm_add_ps(rounded(_mm_mul_ps(_mm_sub_ps(rev_corr, min_dist), slope)),
+				full))};
+			__m128i is_far = {_mm_castps_si128(_mm_cmpgt_ps(rev_corr, darkest_dist))};
+			__m128i is_near = {_mm_castps_si128(_mm_cmple_ps(rev_corr, min_dist))};
+			dark = _mm_or_si128(_mm_andnot_si128(is_far, dark), _mm_and_si128(is_far, alpha));
+			dark = _mm_or_si128(_mm_andnot_si128(is_near, dark), _mm_and_si128(is_near, bright));
+
+			// SSE2 has no gather
+			__m128i floor_texels = {_mm_set_epi32(span.floor_texels[index[3]], span.floor_texels[index[2]],
+				span.floor_texels[index[1]], span.floor_texels[index[0]])};
+			__m128i ceiling_texels = {_mm_set_epi32(span.ceiling_texels[index[3]], span.ceiling_texels[index[2]],
+				span.ceiling_texels[index[1]], span.ceiling_texels[index[0]])};
+			_mm_store_si128(reinterpret_cast<__m128i*>(floor_pixels), shade_sse2(floor_texels, dark));
+			_mm_store_si128(reinterpret_cast<__m128i*>(ceiling_pixels), shade_sse2(ceiling_texels, dark));
+
+			// The framebuffer column is strided, so store pixel by pixel
+			for (int k = 0; k < 4; k++) {
+				span.floor_out[-(j + k) * span.pitch] = floor_pixels[k];
+				span.ceiling_out[(j + k) * span.pitch] = ceiling_pixels[k];
+			}
+		}
+		draw_span_scalar(span, j);
+	}
+
+	__attribute__((target("avx2"))) auto rounded_avx2(__m256 value) -> __m256
+	{
+		asm("" : "+x"(value));
+		return value;
+	}
+
+	__attribute__((target("avx2"))) auto floor_avx2(__m256 value) -> __m256
+	{
+		return _mm256_floor_ps(value);
+	}
+
+	__attribute__((target("avx2"))) auto shade_avx2(__m256i texels, __m256i dark) -> __m256i
+	{
+		const __m256i zero = {_mm256_setzero_si256()};
+		const __m256i one = {_mm256_set1_epi16(1)};
+		__m256i dark_16 = {_mm256_packs_epi32(dark, dark)};
+		dark_16 = _mm256_unpacklo_epi16(dark_16, dark_16);
+		__m256i dark_lo = {_mm256_unpacklo_epi32(dark_16, dark_16)};
+		__m256i dark_hi = {_mm256_unpackhi_epi32(dark_16, dark_16)};
+
+		__m256i lo = {_mm256_mullo_epi16(_mm256_unpacklo_epi8(texels, zero), dark_lo)};
+		__m256i hi = {_mm256_mullo_epi16(_mm256_unpackhi_epi8(texels, zero), dark_hi)};
+		lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one), _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one), _mm256_srli_epi16(hi, 8)), 8);
+
+		return _mm256_packus_epi16(lo, hi);
+	}
+
+	__attribute__((target("avx2"))) auto draw_floor_span_avx2(const FloorSpan& span, int first) -> void
+	{
+		const __m256 height = {_mm256_set1_ps(span.surface_height)};
+		const __m256 min_dist = {_mm256_set1_ps(span.min_dist)};
+		const __m256 darkest_dist = {_mm256_set1_ps(span.darkest_dist)};
+		const __m256 slope = {_mm256_set1_ps(floor_slope(span))};
+		const __m256 full = {_mm256_set1_ps(255.0f)};
+		const __m256 size = {_mm256_set1_ps(static_cast<float>(FLOOR_TEXTURE_SIZE))};
+		const __m256i mask = {_mm256_set1_epi32(FLOOR_TEXTURE_SIZE - 1)};
+		const __m256i alpha = {_mm256_set1_epi32(static_cast<int>(span.darkness_alpha))};
+		const __m256i bright = {_mm256_set1_epi32(255)};
+		const int* floor_texels = {reinterpret_cast<const int*>(span.floor_texels)};
+		const int* ceiling_texels = {reinterpret_cast<const int*>(span.ceiling_texels)};
+
+		alignas(32) std::uint32_t floor_pixels[8];
+		alignas(32) std::uint32_t ceiling_pixels[8];
+
+		int j = {first};
+		for (; j + 8 <= span.rows; j += 8) {
+			__m256 row = {_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(j),
+				_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)))};
+			__m256 rev_corr = {_mm256_div_ps(height, _mm256_sub_ps(height, _mm256_add_ps(row, row)))};
+			__m256 real_x = {_mm256_add_ps(_mm256_set1_ps(span.origin_x),
+				rounded_avx2(_mm256_mul_ps(_mm256_set1_ps(span.dir_x), rev_corr)))};
+			__m256 real_y = {_mm256_add_ps(_mm256_set1_ps(span.origin_y),
+				rounded_avx2(_mm256_mul_ps(_mm256_set1_ps(span.dir_y), rev_corr)))};
+			__m256i tx = {_mm256_and_si256(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(real_x,
+				floor_avx2(real_x)), size)), mask)};
+			__m256i ty = {_mm256_and_si256(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(real_y,
+				floor_avx2(real_y)), size)), mask)};
+			__m256i index = {_mm256_add_epi32(_mm256_slli_epi32(ty, 6), tx)};
+
+			__m256i dark = {_mm256_cvttps_epi32(_mm256_add_ps(rounded_avx2(_mm256_mul_ps(_mm256_sub_ps(rev_corr,
+				min_dist), slope)), full))};
+			__m256i is_far = {_mm256_castps_si256(_mm256_cmp_ps(rev_corr, darkest_dist, _CMP_GT_OQ))};
+			__m256i is_near = {_mm256_castps_si256(_mm256_cmp_ps(rev_corr, min_dist, _CMP_LE_OQ))};
+			dark = _mm256_blendv_epi8(dark, alpha, is_far);
+			dark = _mm256_blendv_epi8(dark, bright, is_near);
+
+			__m256i floor_texel = {_mm256_i32gather_epi32(floor_texels, index, 4)};
+			__m256i ceiling_texel = {_mm256_i32gather_epi32(ceiling_texels, index, 4)};
+			_mm256_store_si256(reinterpret_cast<__m256i*>(floor_pixels), shade_avx2(floor_texel, dark));
+			_mm256_store_si256(reinterpret_cast<__m256i*>(ceiling_pixels), shade_avx2(ceiling_texel, dark));
+
+			for (int k = 0; k < 8; k++) {
+				span.floor_out[-(j + k) * span.pitch] = floor_pixels[k];
+				span.ceiling_out[(j + k) * span.pitch] = ceiling_pixels[k];
+			}
+		}
+		draw_span_scalar(span, j);
+	}
+
+#endif
+
+	auto get_draw_span(FloorKernel kernel) -> DrawSpan
+	{
+		switch (kernel) {
+#ifdef FLOOR_KERNEL_X86
+		case FloorKernel::sse2:
+			return draw_floor_span_sse2;
+		case FloorKernel::avx2:
+			return draw_floor_span_avx2;
+#endif
+		default:
+			return draw_span_scalar;
+		}
+	}
+
+	FloorKernel current_kernel = {FloorKernel::scalar};
+	DrawSpan current_draw_span = {draw_span_scalar};
+}
+
+auto is_floor_kernel_supported(FloorKernel kernel) -> bool
+{
+	switch (kernel) {
+	case FloorKernel::automatic:
+	case FloorKernel::scalar:
+		return true;
+#ifdef FLOOR_KERNEL_X86
+	case FloorKernel::sse2:
+		return __builtin_cpu_supports("sse2");
+	case FloorKernel::avx2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+auto get_floor_kernel_name(FloorKernel kernel) -> const char*
+{
+	switch (kernel) {
+	case FloorKernel::automatic:
+		return "automatic";
+	case FloorKernel::scalar:
+		return "scalar";
+	case FloorKernel::sse2:
+		return "sse2";
+	case FloorKernel::avx2:
+		return "avx2";
+	default:
+		return "unknown";
+	}
+}
+
+auto check_floor_kernel(FloorKernel kernel) -> int
+{
+	if (!is_floor_kernel_supported(kernel))
+		return -1;
+
+	// Synthetic textures and a spread of positions and directions, including negative coordinates
+	const int height = {300};
+	const int rows = {height / 2};
+	std::vector<std::uint32_t> floor_texels(FLOOR_TEXTURE_SIZE * FLOOR_TEXTURE_SIZE);
+	std::vector<std::uint32_t> ceiling_texels(FLOOR_TEXTURE_SIZE * FLOOR_TEXTURE_SIZE);
+	std::uint32_t seed = {12345};
+	for (std::size_t i = 0; i < floor_texels.size(); i++) {
+		seed = seed * 1103515245 + 12345;
+		floor_texels[i] = (seed >> 8) & 0xFFFFFF;
+		ceiling_texels[i] = ~floor_texels[i] & 0xFFFFFF;
+	}
+
+	std::vector<std::uint32_t> expected(height);
+	std::vector<std::uint32_t> actual(height);
+	int mismatches = {0};
+	for (int pose = 0; pose < 64; pose++) {
+		float angle = {pose * 0.1f};
+		FloorSpan span = {floor_texels.data(), ceiling_texels.data(), nullptr, nullptr, 1, rows - pose % 9,
+			-3.0f + pose * 0.37f, 5.5f - pose * 0.21f, std::cos(angle) * 1.3f, std::sin(angle) * 1.3f,
+			static_cast<float>(height), 0.3f, 6.0f, 40.0f};
+
+		span.ceiling_out = expected.data();
+		span.floor_out = expected.data() + height - 1;
+		draw_span_scalar(span, 0);
+		span.ceiling_out = actual.data();
+		span.floor_out = actual.data() + height - 1;
+		get_draw_span(kernel)(span, 0);
+
+		for (int i = 0; i < height; i++)
+			mismatches += expected[i] != actual[i];
+	}
+
+	return mismatches;
+}
+
+auto select_floor_kernel(FloorKernel requested) -> FloorKernel
+{
+	// Use the widest kernel the CPU has, unless it disagrees with the scalar kernel
+	FloorKernel candidates[] = {FloorKernel::avx2, FloorKernel::sse2, FloorKernel::scalar};
+	current_kernel = FloorKernel::scalar;
+	for (FloorKernel candidate : candidates) {
+		if (requested != FloorKernel::automatic && candidate != requested)
+			continue;
+		if (check_floor_kernel(candidate) == 0) {
+			current_kernel = candidate;
+			break;
+		}
+	}
+	current_draw_span = get_draw_span(current_kernel);
+
+	return current_kernel;
+}
+
+auto get_floor_kernel() -> FloorKernel
+{
+	return current_kernel;
+}
+
+auto draw_floor_span(const FloorSpan& span) -> void
+{
+	current_draw_span(span, 0);
+}
@@ -0,0 +1,227 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "grid_map.hpp"
+
+namespace {
+
+	// Map files give each cell as one character: '.' (or a space, or '0') is empty, '1' to '9' and 'A' to 'Z' are
+	// walls 1 to 35
+	auto get_cell_value(char c) -> int
+	{
+		if (c >= '1' && c <= '9')
+			return c - '0';
+		else if (c >= 'A' && c <= 'Z')
+			return c - 'A' + 10;
+		else if (c == '.' || c == ' ' || c == '0')
+			return 0;
+		else
+			return -1;
+	}
+
+	// Heights and lintels are given in tenths, as '0' to '9', with '.' (or a space) for the full height
+	auto get_height_value(char c) -> int
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		else if (c == '.' || c == ' ')
+			return GRID_FULL_HEIGHT;
+		else
+			return -1;
+	}
+
+	// Which field of a cell's style each layer of a map file sets
+	auto get_style_field(GridCellStyle& style, const std::string& layer) -> std::uint8_t*
+	{
+		if (layer == "heights")
+			return &style.height;
+		else if (layer == "lintels")
+			return &style.lintel;
+		else if (layer == "floors")
+			return &style.floor;
+		else if (layer == "ceilings")
+			return &style.ceiling;
+		else
+			return nullptr;
+	}
+}
+
+auto create_grid_map(int width, int height) -> GridMap
+{
+	int blocks_x = {(width + GRID_BLOCK_MASK) >> GRID_BLOCK_SHIFT};
+	int blocks_y = {(height + GRID_BLOCK_MASK) >> GRID_BLOCK_SHIFT};
+	GridMap map = {{}, {}, {}, width, height, blocks_x, 0.5, 0.5, false};
+	map.cells.assign(static_cast<std::size_t>(blocks_x) * blocks_y * GRID_BLOCK_SIZE * GRID_BLOCK_SIZE, 0);
+	map.clearance.assign(map.cells.size(), 0);
+	map.styles.assign(map.cells.size(), GRID_DEFAULT_STYLE);
+
+	return map;
+}
+
+auto load_grid_map(const char* file) -> GridMap
+{
+	// A header line of "width height start_x start_y" followed by one line per row of the map, top row first
+	std::ifstream in(file);
+	int width = {0};
+	int height = {0};
+	double start_x = {0};
+	double start_y = {0};
+	if (!(in >> width >> height >> start_x >> start_y) || width <= 0 || height <= 0) {
+		std::cout << "Map " << file << " could not be loaded! No valid header" << std::endl;
+		return {};
+	}
+
+	GridMap map = {create_grid_map(width, height)};
+	map.start_x = start_x;
+	map.start_y = start_y;
+	std::string line = {};
+	std::getline(in, line);
+	for (int y = height - 1; y >= 0; y--) {
+		if (!std::getline(in, line)) {
+			std::cout << "Map " << file << " could not be loaded! Only " << height - 1 - y << " of " << height <<
+				" rows" << std::endl;
+			return {};
+		}
+
+		// Short rows (trailing spaces trimmed by an editor, say) are empty to the end
+		for (int x = 0; x < width && x < static_cast<int>(line.size()); x++) {
+			int value = {get_cell_value(line[x])};
+			if (value < 0) {
+				std::cout << "Map " << file << " could not be loaded! Unknown cell '" << line[x] << "' in row " <<
+					height - y << std::endl;
+				return {};
+			}
+			set_grid_cell(map, x, y, value);
+		}
+	}
+
+	// Then any layers of cell styles, each a line naming the layer followed by one line per row as above
+	while (std::getline(in, line)) {
+		std::string layer = {line.substr(0, line.find_last_not_of(" \t\r") + 1)};
+		if (layer.empty())
+			continue;
+		GridCellStyle unused = {GRID_DEFAULT_STYLE};
+		if (get_style_field(unused, layer) == nullptr) {
+			std::cout << "Map " << file << " could not be loaded! Unknown layer '" << layer << "'" << std::endl;
+			return {};
+		}
+
+		bool heights = {layer == "heights" || layer == "lintels"};
+		for (int y = height - 1; y >= 0; y--) {
+			if (!std::getline(in, line)) {
+				std::cout << "Map " << file << " could not be loaded! Only " << height - 1 - y << " of " << height <<
+					" rows of " << layer << std::endl;
+				return {};
+			}
+			for (int x = 0; x < width && x < static_cast<int>(line.size()); x++) {
+				int value = {heights ? get_height_value(line[x]) : get_cell_value(line[x])};
+				if (value < 0) {
+					std::cout << "Map " << file << " could not be loaded! Unknown cell '" << line[x] << "' in row " <<
+						height - y << " of " << layer << std::endl;
+					return {};
+				}
+				GridCellStyle style = {get_grid_style(map, x, y)};
+				*get_style_field(style, layer) = static_cast<std::uint8_t>(value);
+				set_grid_style(map, x, y, style);
+			}
+		}
+	}
+
+	if (start_x < 0 || start_y < 0 || get_grid_cell(map, static_cast<int>(start_x), static_cast<int>(start_y)) != 0) {
+		std::cout << "Map " << file << " could not be loaded! The start is not an empty cell" << std::endl;
+		return {};
+	}
+	build_grid_clearance(map);
+
+	return map;
+}
+
+auto tile_grid_map(const GridMap& map, int width, int height) -> GridMap
+{
+	// Copies of the map side by side, keeping the start in the first
+	GridMap tiled = {create_grid_map(width, height)};
+	tiled.start_x = map.start_x;
+	tiled.start_y = map.start_y;
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			set_grid_cell(tiled, x, y, get_grid_cell(map, x % map.width, y % map.height));
+			set_grid_style(tiled, x, y, get_grid_style(map, x % map.width, y % map.height));
+		}
+	build_grid_clearance(tiled);
+
+	return tiled;
+}
+
+auto get_grid_texture_count(const GridMap& map) -> int
+{
+	// The highest wall texture number any wall, floor or ceiling names (the edge always needs its wall)
+	int count = {GRID_EDGE_WALL};
+	for (std::uint8_t cell : map.cells)
+		count = std::max<int>(count, cell);
+	for (const GridCellStyle& style : map.styles)
+		count = std::max<int>({count, style.floor, style.ceiling});
+
+	return count;
+}
+
+auto build_grid_clearance(GridMap& map) -> void
+{
+	// Chessboard distance transform: start from the distance to the edge of the map (everything outside is wall),
+	// then one pass forwards and one backwards each take the smallest of the neighbours already visited plus one
+	const int width = {map.width};
+	const int height = {map.height};
+	std::vector<std::uint8_t> distance(static_cast<std::size_t>(width) * height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			distance[y * width + x] = get_grid_cell(map, x, y) != 0 ? 0 :
+				std::min({x + 1, y + 1, width - x, height - y, 255});
+
+	auto relax = [&distance, width, height](int x, int y, int dx, int dy) {
+		std::uint8_t& d = {distance[y * width + x]};
+		for (int k = 0; k < 4 && d > 1; k++) {
+			// The row before and the cell before in this one
+			int nx = {k < 3 ? x + dx * (k - 1) : x - dx};
+			int ny = {k < 3 ? y - dy : y};
+			if (nx >= 0 && nx < width && ny >= 0 && ny < height)
+				d = std::min<int>(d, distance[ny * width + nx] + 1);
+		}
+	};
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			relax(x, y, 1, 1);
+	for (int y = height - 1; y >= 0; y--)
+		for (int x = width - 1; x >= 0; x--)
+			relax(x, y, -1, -1);
+
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			map.clearance[get_grid_index(map, x, y)] = distance[y * width + x];
+
+	// The renderer only needs its slower path through gaps in walls and cells' own floors and ceilings if there are any
+	map.layered = false;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			GridCellStyle style = {get_grid_style(map, x, y)};
+			bool gap = {get_grid_cell(map, x, y) != 0 && style.height < style.lintel};
+			if (gap || style.floor != 0 || style.ceiling != 0)
+				map.layered = true;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+
+#include "lighting.hpp"
+
+namespace {
+
+	// Unquantised brightness at a distance
+	auto get_darkness(const LightingProfile& profile, double dist) -> double
+	{
+		if (dist > profile.darkest_dist)
+			return profile.darkness_alpha;
+		else if (dist <= profile.min_dist)
+			return 255;
+		else // interpolate
+			return (dist - profile.min_dist) * (profile.darkness_alpha - 255) / (profile.darkest_dist -
+				profile.min_dist) + 255;
+	}
+}
+
+auto build_light_table(const LightingProfile& profile) -> LightTable
+{
+	LightTable table = {profile, {}, {}, {}, false};
+
+	// Levels are spread evenly between full brightness and the darkest the profile goes
+	table.darkness.resize(LIGHT_LEVELS);
+	for (int level = 0; level < LIGHT_LEVELS; level++)
+		table.darkness[level] = 255 - (255 - profile.darkness_alpha) * level / (LIGHT_LEVELS - 1);
+	table.shaded = std::any_of(table.darkness.begin(), table.darkness.end(), [](int level) { return level != 255; });
+
+	table.colormap.resize(LIGHT_LEVELS * 256);
+	for (int level = 0; level < LIGHT_LEVELS; level++)
+		for (int value = 0; value < 256; value++)
+			table.colormap[level * 256 + value] = static_cast<std::uint8_t>(value * table.darkness[level] / 255);
+
+	// One step past darkest_dist, after which everything is at the darkest level
+	int steps = {static_cast<int>(std::ceil(profile.darkest_dist * LIGHT_DISTANCE_STEPS)) + 1};
+	table.levels.resize(steps);
+	for (int step = 0; step < steps; step++) {
+		double darkness = {get_darkness(profile, (step + 0.5) / LIGHT_DISTANCE_STEPS)};
+		int level = {0};
+		if (profile.darkness_alpha < 255)
+			level = static_cast<int>(std::lround((255 - darkness) * (LIGHT_LEVELS - 1) / (255 -
+				profile.darkness_alpha)));
+		table.levels[step] = static_cast<std::uint8_t>(level);
+	}
+	table.levels[steps - 1] = LIGHT_LEVELS - 1;
+
+	return table;
+}
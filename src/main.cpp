@@ -15,13 +15,9 @@
 
 #include "main.hpp"
 
-// Surface Resolution (Pixels)
-const int SURFACE_WIDTH = {400};
-const int SURFACE_HEIGHT = {300};
-
-// Libtcod Window Size (Characters)
-const int WINDOW_WIDTH = {180};
-const int WINDOW_HEIGHT = {100};
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // FOV
 const double FOV = {1.30899694};			// rad (75 deg)
@@ -29,563 +25,1327 @@ const double MIN_DIST = {0.3};				// square sides / s
 const double DARKEST_DIST = {6.0};			// any greater distance will not be darker
 const int DARKNESS_ALPHA = {40};			// minimal lighting
 
-// World Size
-const int GRID_WIDTH = {18};
-const int GRID_HEIGHT = {10};
+// Lighting Profiles (cycled through with L)
+const LightingProfile LIGHTING_PROFILES[] = {
+	{"Default", MIN_DIST, DARKEST_DIST, DARKNESS_ALPHA},
+	{"Torchlight", MIN_DIST, 3.0, 8},
+	{"Daylight", MIN_DIST, 14.0, 120},
+	{"Fullbright", MIN_DIST, DARKEST_DIST, 255}
+};
 
 // Graphics Data
 const int TILE_WIDTH = {64};
 const int TILE_HEIGHT = {64};
 
-// Movement Data
-const double DEFAULT_SPEED = {3};			// sqsides / s
-const double TURN_SPEED = {M_PI}; 			// rad / s
+// Texture Files (every PNG in the wall directory is cut into wall textures, in name order, and sprite texture n is
+// the nth sprite file)
+const char* const WALL_DIRECTORY = {"res/txtrs/walls"};
+const char* const CEILING_FILE = {"res/txtrs/walls/w3d_redbrick.png"};
+const char* const FLOOR_FILE = {"res/txtrs/walls/w3d_bluewall.png"};
+const char* const SPRITE_FILES[] = {"res/txtrs/w3d_hitler.png", "res/txtrs/w3d_grayflag.png"};
 
-// Fixed World Map
-const int world[GRID_HEIGHT][GRID_WIDTH] =
-{
-	{ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
-	{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1 },
-	{ 1, 0, 2, 1, 0, 1, 1, 0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 1 },
-	{ 1, 0, 2, 0, 0, 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 1 },
-	{ 1, 0, 0, 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-	{ 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 1 },
-	{ 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1 },
-	{ 1, 0, 1, 1, 0, 2, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-	{ 1, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-	{ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
-};
+// Asset Cache (textures as they are drawn from, rebuilt whenever any of the texture files change)
+const char* const ASSET_CACHE_FILE = {"res/cache/assets.bin"};
 
-// SDL Data
-SDL_Surface* working_surface = {nullptr};
-SDL_Renderer* renderer = {nullptr};
-SDL_Texture* working_texture = {nullptr};
-SDL_Texture* working_texture_streaming = {nullptr};
-SDL_Texture* floor_texture = {nullptr};
-SDL_Texture* ceiling_texture = {nullptr};
+// Console character for each subcell shape
+const int SUBCELL_CHARACTERS[] = {' ', TCOD_CHAR_SUBP_NW, TCOD_CHAR_SUBP_NE, TCOD_CHAR_SUBP_N, TCOD_CHAR_SUBP_SW,
+	TCOD_CHAR_SUBP_SE, TCOD_CHAR_SUBP_E, TCOD_CHAR_SUBP_DIAG};
 
-SDL_Surface* floor_surface = {nullptr};
-SDL_Surface* ceiling_surface = {nullptr};
-SDL_Texture* wall_textures[3] = {nullptr};
+// Walls with gaps in them drawn in each column, nearest first (any further away are left out)
+const int MAX_COLUMN_LAYERS = {16};
 
-void* memory_pixels = {nullptr};
+// Threading Data
+const int RENDER_TILE_WIDTH = {16};			// columns per unit of work (16 pixels = one cache line per row)
+const int RENDER_TILE_HEIGHT = {8};			// rows per unit of work when casting the floor by rows
 
-// Raycasting Data
-double scr_pts [SURFACE_WIDTH] = {};		// Tangent y-coordinate for theta = 0, one for every horizontal pixel
-double distortion [SURFACE_WIDTH] = {};		// Correction values for distortion
+// Movement Data
+const double DEFAULT_SPEED = {3};			// sqsides / s
+const double TURN_SPEED = {M_PI}; 			// rad / s
 
+// Timing Data
+const int TICK_RATE = {60};					// world updates / s, however often frames are drawn
+const int MAX_TICKS_PER_FRAME = {5};		// after a longer stall the world slows down rather than catching up
+
+// World Map (0 is empty, n is wall texture n - 1, see load_wall_textures())
+GridMap world_map = {};
+
+// Decoded Images (SDL is only used to decode them, and not even that when the asset cache is up to date)
+std::unique_ptr<ResourceCache> resources = {};
+std::shared_ptr<const Image> floor_image = {};
+std::shared_ptr<const Image> ceiling_image = {};
+bool asset_cache = {true};
+bool assets_cached = {false};				// Whether the textures were mapped from the asset cache this time
+Sint64 asset_load_time = {0};				// ns
+
+// Wall Textures (map value n is texture n - 1)
+TextureAtlas wall_atlas = {};
+
+// Sprites (textures keep their alpha, which says which texels are see-through)
+TextureAtlas sprite_atlas = {};
+std::vector<Sprite> sprites = {};
+std::vector<SpriteView> sprite_views = {};	// The sprites on screen this frame, furthest first
+
+// Surface Resolution (pixels, set with --resolution; any size is averaged down to the console's subcells)
+int surface_width = {SURFACE_WIDTH};
+int surface_height = {SURFACE_HEIGHT};
+
+// Software Framebuffer (the raycaster draws directly into this)
+Framebuffer framebuffer = {};
+
+// Render Threads (0 = one per hardware thread, 1 = render on the main thread only)
+unsigned int render_threads = {0};
+std::unique_ptr<ThreadPool> render_pool = {};
+
+// Lighting
+std::vector<LightTable> light_tables = {};
+std::size_t lighting_profile = {0};
+const LightTable* lighting = {nullptr};
+
+// Ray Traversal
+Traversal traversal = {Traversal::skipping};
+
+// Potentially Visible Sets (for the map as loaded, kept in a .pvs file next to it; none with --no-pvs)
+VisibilitySet world_visibility = {};
+bool use_visibility = {true};
+
+// Floor Casting (columns = one span per wall slice, rows = a second pass along each screen row)
+FloorMode floor_mode = {FloorMode::columns};
+
+// Floor Kernel (automatic = widest one the CPU supports, only used when casting columns)
+FloorKernel floor_kernel = {FloorKernel::automatic};
+
+// Presentation Data (each 2x2 block of subcells is written straight into a console cell; a framebuffer of any other
+// size is first box-filtered down to subcells)
+std::vector<Uint32> subcell_pixels = {};
+std::vector<int> present_x = {};			// First framebuffer column for each subcell column, plus an end marker
+std::vector<int> present_y = {};			// First framebuffer row for each subcell row, plus an end marker
+ConsoleCache console_cache = {};			// What the root console was last sent
+
+// Credits
+const std::string LIBTCOD_VERSION = {"Powered by Libtcod " + std::to_string(TCOD_MAJOR_VERSION) + "." +
+	std::to_string(TCOD_MINOR_VERSION) + "." + std::to_string(TCOD_PATCHLEVEL)};
+
+// Raycasting Data (sized for the surface in initialise())
+std::vector<double> scr_pts = {};			// Tangent y-coordinate for theta = 0, one for every horizontal pixel
+std::vector<double> row_distance = {};		// Floor/ceiling distance for every row above the horizon
+std::vector<int> ceiling_rows = {};			// Rows of ceiling visible above each wall slice
+std::vector<int> floor_top = {};			// First row of floor visible below each wall slice
+std::vector<RayHit> column_hits = {};		// What each column's ray hit this frame
+std::vector<double> column_angles = {};		// Angle between each column's ray and the view direction
+std::vector<double> wall_depth = {};		// Distance of each column's wall, which hides any sprite behind it
+std::vector<RayLayer> column_layers = {};	// Walls with gaps in them each column's ray went through this frame
+std::vector<int> layer_counts = {};			// How many there are for each column
+std::vector<ColumnWindow> column_windows = {};	// What each of them leaves open of its column
+
+// Frame Cache (what the framebuffer last showed, so that an unchanged frame can be skipped and a turn on the spot can
+// reuse the last frame's rays)
+bool frame_cache = {true};
+bool frame_valid = {false};
+double frame_x = {0.0};
+double frame_y = {0.0};
+double frame_theta = {0.0};
+const LightTable* frame_lighting = {nullptr};
+std::vector<RayHit> previous_hits = {};
+std::vector<int> reuse_from = {};			// Last frame's column just before this one's ray (-1 to cast it)
+
+// Column Renderer (the specialisation of render_column_tile() for this frame's lighting and settings)
+ColumnRenderer column_renderer = {nullptr};
+
+// View Direction (evaluated once per frame)
+double view_cos = {1.0};
+double view_sin = {0.0};
 
 // Player Info and Movement
-double player_x = {1.5};					// Initial player position
+double player_x = {1.5};					// Player position (starts where the map says)
 double player_y = {1.5};
 double theta = {0.0};						// Initial central ray direction
-int ticks = {};									// ms
-int diff_ticks = {};								// ms
+double previous_x = {1.5};					// As they were before the latest tick
+double previous_y = {1.5};
+double previous_theta = {0.0};
 
 double speed = {0.0}; 						// sqsides/s
 double turn = {0.0};  						// rad/s
 
+// Camera (the player interpolated between the last two ticks, which is what's drawn)
+double camera_x = {1.5};
+double camera_y = {1.5};
+double camera_theta = {0.0};
+
+// Frame Pacing
+int frame_cap = {60};						// frames / s (0 = draw as many as possible)
+
+// Pipelining (frames are rendered on a thread of their own into one of three framebuffers, while the main thread
+// presents whichever was finished last)
+bool pipelined = {true};
+std::unique_ptr<TripleBuffer<Framebuffer>> frames = {};
+std::mutex camera_mutex = {};
+std::condition_variable camera_posted = {};
+CameraState posted_camera = {};
+bool camera_pending = {false};
+bool render_stopping = {false};
+
 // Functions
-template <typename T>
-auto sign(T val) -> int
+auto get_wall_texture_files(const char* directory) -> std::vector<std::string>
 {
-    return (T(0) < val) - (val < T(0));
+	// Every PNG in the directory in name order, so the same files always give the same numbers
+	std::vector<std::string> files = {};
+	std::error_code error = {};
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+		if (entry.is_regular_file() && entry.path().extension() == ".png")
+			files.push_back(entry.path().string());
+	std::sort(files.begin(), files.end());
+
+	return files;
 }
 
-Uint32 get_pixel(SDL_Surface *surface, int x, int y)
+auto load_wall_textures(const std::vector<std::string>& files) -> int
 {
-	// Here p is the address to the pixel we want to retrieve
-    int bpp = {surface->format->BytesPerPixel};
-	Uint8* p = {static_cast<Uint8*>(surface->pixels + y * surface->pitch + x * bpp)};
-
-	switch (bpp) {
-	case 1:
-		return *p;
-		break;
-	case 2:
-		return *(reinterpret_cast<Uint16*>(p));
-		break;
-	case 3:
-		if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-			return p[0] << 16 | p[1] << 8 | p[2];
-		else
-			return p[0] | p[1] << 8 | p[2] << 16;
-		break;
-	case 4:
-		return *(reinterpret_cast<Uint32*>(p));
-		break;
-	default:
-		return 0;
+	// Each file cut into as many tiles as it holds (left to right, top to bottom)
+	wall_atlas = create_texture_atlas(TILE_WIDTH);
+	for (const std::shared_ptr<const Image>& image : resources->load_images(files, SDL_PIXELFORMAT_RGB888,
+		render_pool.get())) {
+		// A missing file would move every texture after it, so it fails the lot
+		if (image == nullptr)
+			return 0;
+
+		for (int y = 0; y + TILE_HEIGHT <= image->height; y += TILE_HEIGHT)
+			for (int x = 0; x + TILE_WIDTH <= image->width; x += TILE_WIDTH)
+				add_atlas_texture(wall_atlas, image->pixels + y * image->width + x, image->width);
 	}
-}
-
-bool is_colliding(double x, double y)
-{
-	int arr_x = {std::floor(x)};
-	int arr_y = {GRID_HEIGHT - 1 - std::floor(y)};
 
-	return world[arr_y][arr_x] != 0;
+	return get_atlas_count(wall_atlas);
 }
 
-auto crop_texture(SDL_Texture* source, int x, int y) -> SDL_Texture*
+auto load_sprite_textures() -> int
 {
-	SDL_Texture* destination = SDL_CreateTexture(renderer, working_surface->format->format, SDL_TEXTUREACCESS_TARGET,
-		TILE_WIDTH, TILE_HEIGHT);
-	SDL_Rect rect = {TILE_WIDTH * x, TILE_HEIGHT * y, TILE_WIDTH, TILE_HEIGHT};
-	SDL_SetRenderTarget(renderer, destination);
-	SDL_RenderCopy(renderer, source, &rect, nullptr);
-	SDL_SetRenderTarget(renderer, nullptr);
-
-	return destination;
+	// Unlike walls, sprites keep their alpha
+	sprite_atlas = create_texture_atlas(SPRITE_TEXTURE_SIZE);
+	std::vector<std::string> files(std::begin(SPRITE_FILES), std::end(SPRITE_FILES));
+	for (const std::shared_ptr<const Image>& image : resources->load_images(files, SDL_PIXELFORMAT_ARGB8888,
+		render_pool.get())) {
+		if (image == nullptr)
+			return -1;
+
+		add_atlas_texture(sprite_atlas, image->pixels, image->width);
+	}
+
+	return get_atlas_count(sprite_atlas);
 }
 
-auto load_texture(const char* file) -> SDL_Texture*
+auto load_textures() -> int
 {
-	SDL_Surface* surface = {load_surface(file)};
-	if (!surface)
-		std::cout << "IMG_LoadPNG_RW: " << IMG_GetError() << std::endl;
+	Sint64 started = {get_nanoseconds()};
+
+	// Straight from the asset cache, if none of the files it was built from have changed since
+	std::vector<std::string> wall_files = {get_wall_texture_files(WALL_DIRECTORY)};
+	std::vector<std::string> sources = {wall_files};
+	sources.insert(sources.end(), std::begin(SPRITE_FILES), std::end(SPRITE_FILES));
+	sources.push_back(CEILING_FILE);
+	sources.push_back(FLOOR_FILE);
+	std::uint64_t key = {get_asset_key(sources, (static_cast<std::uint64_t>(TILE_WIDTH) << 32) | SPRITE_TEXTURE_SIZE)};
+	AssetPack pack = {asset_cache ? load_asset_cache(ASSET_CACHE_FILE, key) : AssetPack{}};
+	assets_cached = pack.atlases.size() == 2 && pack.images.size() == 2;
+	if (assets_cached) {
+		wall_atlas = pack.atlases[0];
+		sprite_atlas = pack.atlases[1];
+		ceiling_image = pack.images[0];
+		floor_image = pack.images[1];
+		asset_load_time = get_nanoseconds() - started;
+		return 0;
+	}
 
-	SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-	SDL_FreeSurface(surface);
+	// Otherwise decode every file (the floor and ceiling are wall textures too, so they are only decoded once) and
+	// write the cache for next time
+	resources = std::make_unique<ResourceCache>();
+	if (load_wall_textures(wall_files) == 0) {
+		std::cout << "Wall textures could not be loaded! SDL_Error: " << SDL_GetError() << std::endl;
+		return -1;
+	}
+	ceiling_image = resources->load_image(CEILING_FILE, SDL_PIXELFORMAT_RGB888);
+	floor_image = resources->load_image(FLOOR_FILE, SDL_PIXELFORMAT_RGB888);
+	if (!ceiling_image || !floor_image) {
+		std::cout << "Textures could not be loaded! SDL_Error: " << SDL_GetError() << std::endl;
+		return -1;
+	}
+	if (load_sprite_textures() < 0) {
+		std::cout << "Sprite textures could not be loaded! SDL_Error: " << SDL_GetError() << std::endl;
+		return -1;
+	}
+	if (asset_cache)
+		save_asset_cache(ASSET_CACHE_FILE, key, {&wall_atlas, &sprite_atlas}, {ceiling_image.get(), floor_image.get()});
+	asset_load_time = get_nanoseconds() - started;
 
-	return texture;
+	return 0;
 }
 
-auto load_surface (const char * file) -> SDL_Surface*
+auto prepare_visibility(const std::string& map_file) -> void
 {
-	SDL_RWops* io = {SDL_RWFromFile(file, "rb")};
-	SDL_Surface* loaded = {IMG_LoadPNG_RW(io)};
-	SDL_Surface* conv = {nullptr};
-	if (loaded != nullptr) {
-		conv = SDL_ConvertSurface(loaded, working_surface->format, 0);
-		SDL_FreeSurface(loaded);
+	// Built the first time a map is used (on the render threads) and loaded from then on, until the map changes. A
+	// map too large to build one for goes without.
+	if (!use_visibility || static_cast<std::int64_t>(world_map.width) * world_map.height > VISIBILITY_MAX_CELLS)
+		return;
+	std::string file = {std::filesystem::path(map_file).replace_extension(".pvs").string()};
+	std::uint64_t key = {get_asset_key({map_file}, static_cast<std::uint64_t>(VISIBILITY_ORIGINS) << 32 |
+		VISIBILITY_RAYS)};
+	world_visibility = load_visibility(file.c_str(), key);
+	if (world_visibility.width == 0) {
+		world_visibility = build_visibility(world_map, render_pool.get());
+		save_visibility(file.c_str(), key, world_visibility);
 	}
-
-	return conv;
 }
 
-auto initialise() -> int
+auto initialise(bool headless) -> int
 {
 	double tan_FOV = {tan (FOV / 2)};
 
 	// A ray will be cast for every horizontal pixel
-    for (int i = 0; i < SURFACE_WIDTH; i++) {
-		scr_pts[i] = tan_FOV - (2 * tan_FOV * (i + 1)) / SURFACE_WIDTH;
-		distortion[i] = 1.0 / sqrt(1 + scr_pts[i] * scr_pts[i]);
+	scr_pts.resize(surface_width);
+	column_angles.resize(surface_width);
+	ceiling_rows.resize(surface_width);
+	floor_top.resize(surface_width);
+	column_hits.resize(surface_width);
+	wall_depth.resize(surface_width);
+	column_layers.resize(surface_width * MAX_COLUMN_LAYERS);
+	layer_counts.assign(surface_width, 0);
+	column_windows.resize(surface_width * MAX_COLUMN_LAYERS);
+	previous_hits.resize(surface_width);
+	reuse_from.resize(surface_width);
+    for (int i = 0; i < surface_width; i++) {
+		scr_pts[i] = tan_FOV - (2 * tan_FOV * (i + 1)) / surface_width;
+		column_angles[i] = std::atan(scr_pts[i]);
+	}
+
+	// Floor and ceiling distance only depends on the row
+	row_distance.resize(surface_height / 2);
+	for (int j = 0; j < surface_height / 2; j++) {
+		row_distance[j] = 1.0 * surface_height / (surface_height - 2 * j);
 	}
 
+	// Shading tables for every lighting profile, so switching between them costs nothing
+	for (const LightingProfile& profile : LIGHTING_PROFILES)
+		light_tables.push_back(build_light_table(profile));
+	lighting = &light_tables[lighting_profile];
+
 	// Initialise SDL
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+	if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
 		std::cout << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
 		return -1;
 	}
 
-	working_surface = SDL_CreateRGBSurface(0, SURFACE_WIDTH, SURFACE_HEIGHT, 32, 0, 0, 0, 0);
-	if (working_surface == nullptr) {
-		std::cout << "Surface could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-		return -1;
-	}
-	renderer = SDL_CreateSoftwareRenderer(working_surface);
-	if (renderer == nullptr) {
-		std::cout << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+	// Set up the PNG loader now, as textures may be decoded on several threads at once
+	IMG_Init(IMG_INIT_PNG);
+
+	if (render_threads == 0)
+		render_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	if (render_threads > 1)
+		render_pool = std::make_unique<ThreadPool>(render_threads);
+
+	floor_kernel = select_floor_kernel(floor_kernel);
+
+	framebuffer.width = surface_width;
+	framebuffer.height = surface_height;
+	framebuffer.pixels.assign(surface_width * surface_height, 0);
+
+    // Load Textures
+	if (load_textures() < 0)
 		return -1;
+
+	// Initialise libtcod (there's no window when benchmarking)
+	if (!headless)
+		TCODConsole::initRoot(WINDOW_WIDTH, WINDOW_HEIGHT, "Libtcod Raycaster Demo", false, TCOD_RENDERER_SDL);
+
+	// Unless the framebuffer is already at the console's subcell resolution, work out once which of its pixels each
+	// subcell covers
+	if (surface_width != SURFACE_WIDTH || surface_height != SURFACE_HEIGHT) {
+		subcell_pixels.assign(SURFACE_WIDTH * SURFACE_HEIGHT, 0);
+		present_x.resize(SURFACE_WIDTH + 1);
+		present_y.resize(SURFACE_HEIGHT + 1);
+		for (int x = 0; x <= SURFACE_WIDTH; x++)
+			present_x[x] = x * framebuffer.width / SURFACE_WIDTH;
+		for (int y = 0; y <= SURFACE_HEIGHT; y++)
+			present_y[y] = y * framebuffer.height / SURFACE_HEIGHT;
 	}
-	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
 
-	working_texture = SDL_CreateTexture(renderer, working_surface->format->format, SDL_TEXTUREACCESS_TARGET,
-		SURFACE_WIDTH, SURFACE_HEIGHT);
-	if (working_texture == nullptr) {
-		std::cout << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-		return -1;
+    return 0;
+}
+
+auto is_frame_unchanged() -> bool
+{
+	return frame_cache && frame_valid && camera_x == frame_x && camera_y == frame_y &&
+		camera_theta == frame_theta && lighting == frame_lighting;
+}
+
+auto render(Framebuffer& target) -> void
+{
+	view_cos = std::cos(camera_theta);
+	view_sin = std::sin(camera_theta);
+	column_renderer = select_column_renderer();
+	project_sprites(sprites, world_visibility, camera_x, camera_y, view_cos, view_sin, std::tan(FOV / 2), surface_width,
+		sprite_views);
+
+	// Turning on the spot, every ray that lies between two of the last frame's (angles go down from left to right)
+	// may be able to take its hit from them
+	std::fill(reuse_from.begin(), reuse_from.end(), -1);
+	if (frame_cache && frame_valid && camera_x == frame_x && camera_y == frame_y) {
+		std::copy(column_hits.begin(), column_hits.end(), previous_hits.begin());
+		int from = {0};
+		for (int i = 0; i < surface_width; i++) {
+			double angle = {camera_theta - frame_theta + column_angles[i]};
+			while (from + 1 < surface_width && column_angles[from + 1] >= angle)
+				from++;
+			if (from + 1 < surface_width && column_angles[from] >= angle)
+				reuse_from[i] = from;
+		}
+	}
+	frame_valid = true;
+	frame_x = camera_x;
+	frame_y = camera_y;
+	frame_theta = camera_theta;
+	frame_lighting = lighting;
+
+	if (render_pool == nullptr) {
+		column_renderer(target, 0, surface_width);
+		if (floor_mode == FloorMode::rows && !world_map.layered)
+			render_floor_rows(target, 0, surface_height / 2);
+		render_sprites(target, 0, surface_width);
+		return;
 	}
 
-	working_texture_streaming = SDL_CreateTexture(renderer, working_surface->format->format,
-		SDL_TEXTUREACCESS_STREAMING, SURFACE_WIDTH, SURFACE_HEIGHT);
-	if (working_texture_streaming == nullptr) {
-		std::cout << "Texture Streaming could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-		return -1;
+	// Columns are independent, so tiles write to disjoint parts of the framebuffer and need no locking
+	auto render_tile = [&target](int tile) {
+		int first = {tile * RENDER_TILE_WIDTH};
+		column_renderer(target, first, std::min(first + RENDER_TILE_WIDTH, surface_width));
+	};
+	render_pool->parallel_for((surface_width + RENDER_TILE_WIDTH - 1) / RENDER_TILE_WIDTH, render_tile);
+
+	// As are rows once every wall slice is known
+	if (floor_mode == FloorMode::rows && !world_map.layered) {
+		auto render_band = [&target](int band) {
+			int first = {band * RENDER_TILE_HEIGHT};
+			render_floor_rows(target, first, std::min(first + RENDER_TILE_HEIGHT, surface_height / 2));
+		};
+		render_pool->parallel_for((surface_height / 2 + RENDER_TILE_HEIGHT - 1) / RENDER_TILE_HEIGHT, render_band);
 	}
 
-	floor_texture = SDL_CreateTexture (renderer, working_surface->format->format, SDL_TEXTUREACCESS_STREAMING, 1,
-		SURFACE_HEIGHT);
-	if (floor_texture == nullptr) {
-		std::cout << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-		return -1;
+	// And sprites go over the lot, a tile of columns at a time
+	if (!sprite_views.empty()) {
+		auto render_sprite_tile = [&target](int tile) {
+			int first = {tile * RENDER_TILE_WIDTH};
+			render_sprites(target, first, std::min(first + RENDER_TILE_WIDTH, surface_width));
+		};
+		render_pool->parallel_for((surface_width + RENDER_TILE_WIDTH - 1) / RENDER_TILE_WIDTH, render_sprite_tile);
 	}
+}
 
-	ceiling_texture = SDL_CreateTexture (renderer, working_surface->format->format,
-		SDL_TEXTUREACCESS_STREAMING, 1, SURFACE_HEIGHT);
-	if (ceiling_texture == nullptr) {
-		std::cout << "Texture could not be created! SDL_Error:  " << SDL_GetError() << std::endl;
-		return -1;
-    }
+auto select_column_renderer() -> ColumnRenderer
+{
+	// Every combination is compiled in, indexed by whether shading changes anything, whether the floor is drawn with
+	// the walls and whether stages are being timed
+	static const ColumnRenderer renderers[2][2][2] = {
+		{{render_column_tile<false, false, false>, render_column_tile<false, false, true>},
+			{render_column_tile<false, true, false>, render_column_tile<false, true, true>}},
+		{{render_column_tile<true, false, false>, render_column_tile<true, false, true>},
+			{render_column_tile<true, true, false>, render_column_tile<true, true, true>}}
+	};
+
+	// On a map with gaps in walls or cells' own floors and ceilings, floors are always drawn with the walls
+	static const ColumnRenderer layered_renderers[2][2] = {
+		{render_layered_tile<false, false>, render_layered_tile<false, true>},
+		{render_layered_tile<true, false>, render_layered_tile<true, true>}
+	};
+	if (world_map.layered)
+		return layered_renderers[lighting->shaded][is_profiling()];
+
+	return renderers[lighting->shaded][floor_mode == FloorMode::columns][is_profiling()];
+}
 
-    // Load Textures
-	SDL_Texture* all_walls = {load_texture("res/txtrs/w3d_allwalls.png")};
-	wall_textures[0] = crop_texture(all_walls, 0, 0);
-	wall_textures[1] = crop_texture(all_walls, 0, 1);
-	wall_textures[2] = crop_texture(all_walls, 4, 3);
-	ceiling_surface = load_surface ("res/txtrs/w3d_redbrick.png");
-	floor_surface = load_surface ("res/txtrs/w3d_bluewall.png");
+template <bool Shaded, bool FloorColumns, bool Timed>
+auto render_column_tile(Framebuffer& target, int first, int last) -> void
+{
+	Uint32* pixels = {target.pixels.data()};
+	const int pitch = {target.width};
+	Sint64 started = {Timed ? get_nanoseconds() : 0};
+
+	// Cast every ray (pixel column) in the tile through its point on the camera plane, so that distances come out
+	// already corrected, unless it can be worked out from the last frame's
+	for (int i = first; i < last; i++) {
+		double dir_x = {view_cos - view_sin * scr_pts[i]};
+		double dir_y = {view_sin + view_cos * scr_pts[i]};
+		int from = {reuse_from[i]};
+		if (from < 0 || !interpolate_ray(previous_hits[from], previous_hits[from + 1],
+			column_angles[from] - column_angles[from + 1], camera_x, camera_y, dir_x, dir_y, column_hits[i]))
+			column_hits[i] = cast_ray(traversal, world_map, camera_x, camera_y, dir_x, dir_y);
+	}
+	Sint64 cast = {Timed ? get_nanoseconds() : 0};
+
+	// Then draw the wall slices
+	for (int i = first; i < last; i++) {
+		const RayHit& hit = {column_hits[i]};
+
+        // Calculate height
+        double corrected = {hit.dist};
+        int height = {static_cast<int>(surface_height / corrected)};
+
+		int y = {(surface_height - height) / 2};
+		const Uint8* colormap = {Shaded ? get_colormap_row(*lighting, get_light_level(*lighting, corrected)) : nullptr};
+
+		// Draw the visible part of the wall slice from the closest mip level, stepping down the (transposed) texture
+		// column in 16.16 fixed point
+		const int level = {get_atlas_level(wall_atlas, height)};
+		const Uint32* texels = {get_atlas_column(wall_atlas, hit.wall - 1, level, hit.txt_x >> level)};
+		int y_start = {std::max(y, 0)};
+		int y_end = {std::min(y + height, surface_height)};
+		Uint32 txt_step = {static_cast<Uint32>(((TILE_HEIGHT >> level) << 16) / std::max(height, 1))};
+		Uint32 txt_pos = {static_cast<Uint32>(y_start - y) * txt_step};
+		for (int j = y_start; j < y_end; j++) {
+			Uint32 texel = {texels[txt_pos >> 16]};
+			if constexpr (Shaded)
+				pixels[j * pitch + i] = shade_texel(colormap, texel);
+			else
+				pixels[j * pitch + i] = texel & 0xFFFFFF;
+			txt_pos += txt_step;
+		}
 
+		ceiling_rows[i] = y_start;
+		floor_top[i] = y_end;
+		wall_depth[i] = corrected;
+	}
+	Sint64 walls = {Timed ? get_nanoseconds() : 0};
+
+	// And now deal with floor texture pixels
+	if constexpr (FloorColumns) {
+		for (int i = first; i < last; i++) {
+			int y = {ceiling_rows[i]};
+			int height = {floor_top[i] - y};
+			if (y > 0) {
+				FloorSpan span = {floor_image->pixels, ceiling_image->pixels, pixels + i,
+					pixels + (2 * y + height - 1) * pitch + i, pitch, y, static_cast<float>(camera_x),
+					static_cast<float>(camera_y), static_cast<float>(view_cos - view_sin * scr_pts[i]),
+					static_cast<float>(view_sin + view_cos * scr_pts[i]), static_cast<float>(surface_height),
+					static_cast<float>(lighting->profile.min_dist), static_cast<float>(lighting->profile.darkest_dist),
+					static_cast<float>(lighting->profile.darkness_alpha)};
+				draw_floor_span(span);
+			}
 
-	// Initialise libtcod
-	TCODConsole::initRoot(WINDOW_WIDTH, WINDOW_HEIGHT, "Libtcod Raycaster Demo", false, TCOD_RENDERER_SDL);
+			// An odd wall height leaves one row under the floor that nothing covers
+			for (int j = 2 * y + height; j < surface_height; j++)
+				pixels[j * pitch + i] = 0;
+		}
+	}
 
-    return 0;
+	if constexpr (Timed) {
+		Sint64 floors = {get_nanoseconds()};
+		record_profile(ProfileStage::ray_walk, started, cast);
+		record_profile(ProfileStage::wall_draw, cast, walls);
+		if constexpr (FloorColumns)
+			record_profile(ProfileStage::floor_draw, walls, floors);
+	}
 }
 
-auto render() -> void
+template <bool Shaded, bool Timed>
+auto render_layered_tile(Framebuffer& target, int first, int last) -> void
 {
-	// For every ray (pixel column)
-	for (int i = 0; i < SURFACE_WIDTH; i++) {
-        double r_x = {1.0};
-        double r_y = {scr_pts[i]};
-		double base = {std::sqrt(r_x * r_x + r_y * r_y)};
-		r_x = r_x / base;
-		r_y = r_y / base;
-
-        // Rotate this ray with theta
-        double rot_x = {std::cos (theta) * r_x - std::sin (theta) * r_y};
-        double rot_y = {std::sin (theta) * r_x + std::cos (theta) * r_y};
-
-        // Step sizes
-        int step_x = {sign(rot_x)};
-        int step_y = {sign(rot_y)};
-
-        // Calculate Grid lines and hitpoints
-        int l_vx = {std::round(player_x + 0.5 * step_x)};
-        double l_vy = {-1};
-        int l_hy = {std::round(player_y + 0.5 * step_y)};
-        double l_hx = {-1};
-
-        // Find where ray hits
-        double dist = {-1};
-		int txt_x = {-1}; // 0..63 (texture width = 64)
-
-        double hit_x = {0};
-        double hit_y = {0};
-		int wall_idx = {};
-        while (dist < 0)
-        {
-            // Calculate the hitpoints using the Grid lines
-            if (l_vy == -1 && step_x != 0)
-                l_vy = player_y + (l_vx - player_x) * (rot_y / rot_x);
-
-            if (l_hx == -1 && step_y != 0)
-                l_hx = player_x + (l_hy - player_y) * (rot_x / rot_y);
-
-            // Determine which one "wins" (i,e. the shortest distance/closest one)
-            bool vertical_wins = {};
-            if (l_vy != -1 && l_hx != -1) {
-                vertical_wins = step_x * (l_vx - player_x) < step_x * (l_hx - player_x);
-            } else {
-                vertical_wins = l_vy != -1;
-            }
-
-            // Determine array indices
-            int arr_x = {-1};
-            int arr_y = {-1};
-            if (vertical_wins) {
-                hit_x = l_vx;
-                hit_y = l_vy;
-				txt_x = 64 * (hit_y - std::floor(hit_y));
-
-				// If looking from the left, mirror the texture to correct
-				if (step_x == 1)
-					txt_x = 63 - txt_x;
-
-                l_vx += step_x;
-                l_vy = -1;
-                arr_x = step_x < 0 ? hit_x - 1: hit_x;
-                arr_y = GRID_HEIGHT - hit_y;
-            } else {
-                hit_x = l_hx;
-                hit_y = l_hy;
-				txt_x = 64 * (hit_x - std::floor(hit_x));
-
-				// If looking from above, mirror the texture to correct
-				if (step_y == -1)
-					txt_x = 63 - txt_x;
-
-                l_hx = -1;
-                l_hy += step_y;
-                arr_x = hit_x;
-                arr_y = GRID_HEIGHT - (step_y < 0 ? hit_y - 1: hit_y) - 1;
-            }
-
-            // If we've hit a block
-            wall_idx = world[arr_y][arr_x];
-            if (wall_idx != 0) {
-                double dx = {hit_x - player_x};
-                double dy = {hit_y - player_y};
-                dist = std::sqrt(dx * dx + dy * dy);
-            }
-        }
-
-        // Correct distance and calculate height
-        double corrected = {dist * distortion[i]};
-        int height = {SURFACE_HEIGHT / corrected};
-
-		int y = {(SURFACE_HEIGHT - height) / 2};
-		int darkness = {255};
-		if (corrected > DARKEST_DIST)
-			darkness = DARKNESS_ALPHA;
-		else if (corrected <= MIN_DIST)
-			darkness = 255;
-		else // interpolate
-			darkness = std::floor((corrected - MIN_DIST) * (DARKNESS_ALPHA - 255) / (DARKEST_DIST - MIN_DIST) + 255);
-
-		// Get the slice of the texture to render
-		SDL_Rect source = {txt_x, 0, 1, 64};
-		SDL_Rect destination = {i, y, 1, height};
-
-		// Render the slice
-		SDL_Texture* texture = {wall_textures[wall_idx - 1]};
-		SDL_SetTextureColorMod(texture, darkness, darkness, darkness);
-		SDL_RenderCopy(renderer, texture, &source, &destination);
-
-		// And now deal with floor texture pixels
-		if (y > 0) {
-			Uint32 floor[y] = {};
-			Uint32 ceiling[y] = {};
-			Uint32* pixsflr = {reinterpret_cast<Uint32*>(floor_surface->pixels)};
-			Uint32* pixsclg = {reinterpret_cast<Uint32*>(ceiling_surface->pixels)};
-			for (int j = y - 1 ; j >= 0; j--) {
-				double rev_height =  {SURFACE_HEIGHT - 2 * j};
-				double rev_corr = {SURFACE_HEIGHT / rev_height};
-				double rev_dist = {rev_corr / distortion[i]};
-
-				double real_x = {player_x + rot_x * rev_dist};
-				double real_y = {player_y + rot_y * rev_dist};
-				real_x = real_x - static_cast<int>(real_x);
-				real_y = real_y - static_cast<int>(real_y);
-				if (real_x < 0)
-					real_x += 1;
-				if (real_y < 0)
-					real_y += 1;
-				int tx = {std::floor(real_x * 64)};
-				int ty = {std::floor(real_y * 64)};
-
-				int dark_floor = {255};
-				if (rev_corr > DARKEST_DIST)
-					dark_floor = DARKNESS_ALPHA;
-				else if (rev_corr <= MIN_DIST)
-					dark_floor = 255;
-				else // interpolate
-					dark_floor = std::floor((rev_corr - MIN_DIST) * (DARKNESS_ALPHA - 255) /
-						(DARKEST_DIST - MIN_DIST) + 255);
-				double scale = {1.0 * dark_floor / 255};
-
-				Uint32 floor_pixel = {static_cast<Uint32>(pixsflr[64 * ty + tx])};
-				Uint32 ceiling_pixel = {static_cast<Uint32>(pixsclg[64 * ty + tx])};
-
-				Uint32 f_r = {((floor_pixel >> 16) & 0xFF) * scale};
-				Uint32 f_g = {((floor_pixel >> 8) & 0xFF) * scale};
-				Uint32 f_b = {((floor_pixel >> 0) & 0xFF) * scale};
-				floor[y - 1 - j] = (f_r << 16) + (f_g << 8) + (f_b << 0);
-
-				Uint32 g_r = {((ceiling_pixel >> 16) & 0xFF) * scale};
-				Uint32 g_g = {((ceiling_pixel >> 8) & 0xFF) * scale};
-				Uint32 g_b = {((ceiling_pixel >> 0) & 0xFF) * scale};
-				ceiling[j] = (g_r << 16) + (g_g << 8) + (g_b << 0);
+	Uint32* pixels = {target.pixels.data()};
+	const int pitch = {target.width};
+	Sint64 started = {Timed ? get_nanoseconds() : 0};
+
+	// Cast every ray on through any walls with gaps in them to the first wall that fills its square. The last frame's
+	// rays are never reused, as they only kept where they stopped.
+	for (int i = first; i < last; i++) {
+		double dir_x = {view_cos - view_sin * scr_pts[i]};
+		double dir_y = {view_sin + view_cos * scr_pts[i]};
+		column_hits[i] = cast_ray_layers(world_map, camera_x, camera_y, dir_x, dir_y,
+			&column_layers[i * MAX_COLUMN_LAYERS], MAX_COLUMN_LAYERS, layer_counts[i]);
+	}
+	Sint64 cast = {Timed ? get_nanoseconds() : 0};
+
+	// Then fill each column front to back, keeping the rows between top and bottom that are still open. The floor and
+	// the lower parts of walls only hide things further up the screen than they are, and the ceiling and upper parts
+	// things further down, so each one drawn closes the open rows from one end.
+	for (int i = first; i < last; i++) {
+		double dir_x = {view_cos - view_sin * scr_pts[i]};
+		double dir_y = {view_sin + view_cos * scr_pts[i]};
+		Uint32* column = {pixels + i};
+		const RayLayer* layers = {&column_layers[i * MAX_COLUMN_LAYERS]};
+		const int count = {layer_counts[i]};
+		int top = {0};
+		int bottom = {surface_height};
+		for (int k = 0; k <= count; k++) {
+			const RayHit& hit = {k < count ? layers[k].hit : column_hits[i]};
+			int wall_top = {0};
+			int wall_height = {get_wall_span(hit.dist, wall_top)};
+			int wall_bottom = {wall_top + wall_height};
+
+			// The floor and ceiling up to the wall
+			int floor_start = {std::clamp(wall_bottom, top, bottom)};
+			draw_plane_rows<Shaded>(column, pitch, dir_x, dir_y, 0, false, floor_start, bottom);
+			bottom = floor_start;
+			int ceiling_end = {std::clamp(wall_top, top, bottom)};
+			draw_plane_rows<Shaded>(column, pitch, dir_x, dir_y, GRID_FULL_HEIGHT, true, top, ceiling_end);
+			top = ceiling_end;
+
+			// The wall that fills its square fills whatever is left
+			const Uint8* colormap = {Shaded ? get_colormap_row(*lighting, get_light_level(*lighting, hit.dist)) :
+				nullptr};
+			if (k == count) {
+				draw_wall_rows<Shaded>(column, pitch, hit, colormap, wall_top, wall_height, top, bottom);
+				break;
 			}
 
-			// And render floor/ceiling
-			int pitch = {1 * sizeof(Uint32)};
-			SDL_Rect rect = {0, 0, 1, y};
-			if (SDL_LockTexture(floor_texture, &rect, &memory_pixels, &pitch) != 0)
-				std::cout << SDL_GetError() << std::endl;
+			// Otherwise the wall's lower and upper parts, and then (as far as the ray goes through its cell) the top of
+			// the lower part if that's below eye level, and the underside of the upper part if that's above
+			GridCellStyle style = {get_grid_style(world_map, hit.cell_x, hit.cell_y)};
+			int lower_top = {std::clamp(wall_bottom - wall_height * style.height / GRID_FULL_HEIGHT, top, bottom)};
+			draw_wall_rows<Shaded>(column, pitch, hit, colormap, wall_top, wall_height, lower_top, bottom);
+			bottom = lower_top;
+			int upper_bottom = {std::clamp(wall_top + wall_height * (GRID_FULL_HEIGHT - style.lintel) /
+				GRID_FULL_HEIGHT, top, bottom)};
+			draw_wall_rows<Shaded>(column, pitch, hit, colormap, wall_top, wall_height, top, upper_bottom);
+			top = upper_bottom;
+
+			int exit_top = {0};
+			int exit_height = {get_wall_span(layers[k].exit, exit_top)};
+			if (2 * style.height < GRID_FULL_HEIGHT) {
+				int roof_start = {std::clamp(exit_top + exit_height - exit_height * style.height / GRID_FULL_HEIGHT,
+					top, bottom)};
+				draw_plane_rows<Shaded>(column, pitch, dir_x, dir_y, style.height, false, roof_start, bottom);
+				bottom = roof_start;
+			}
+			if (2 * style.lintel > GRID_FULL_HEIGHT) {
+				int underside_end = {std::clamp(exit_top + exit_height * (GRID_FULL_HEIGHT - style.lintel) /
+					GRID_FULL_HEIGHT, top, bottom)};
+				draw_plane_rows<Shaded>(column, pitch, dir_x, dir_y, style.lintel, true, top, underside_end);
+				top = underside_end;
+			}
+			column_windows[i * MAX_COLUMN_LAYERS + k] = {hit.dist, top, bottom};
+		}
+		wall_depth[i] = column_hits[i].dist;
+	}
+
+	if constexpr (Timed) {
+		Sint64 drawn = {get_nanoseconds()};
+		record_profile(ProfileStage::ray_walk, started, cast);
+		record_profile(ProfileStage::wall_draw, cast, drawn);
+	}
+}
 
-			Uint8* pixels = {reinterpret_cast<Uint8*>(memory_pixels)};
-			memcpy(pixels, floor, y * pitch);
-			SDL_UnlockTexture(floor_texture);
-			SDL_Rect destination_floor = {i, y + height, 1, y};
-			SDL_RenderCopy (renderer, floor_texture, &rect, &destination_floor);
+auto get_wall_span(double dist, int& top) -> int
+{
+	// As render_column_tile() places a wall slice
+	int height = {static_cast<int>(surface_height / dist)};
+	top = (surface_height - height) / 2;
 
-			if (SDL_LockTexture(ceiling_texture, &rect, &memory_pixels, &pitch) != 0)
-				std::cout << SDL_GetError() << std::endl;
+	return height;
+}
 
-			pixels = {reinterpret_cast<Uint8*>(memory_pixels)};
-			memcpy(pixels, ceiling, y * pitch);
-			SDL_UnlockTexture(ceiling_texture);
+template <bool Shaded>
+auto draw_wall_rows(Uint32* column, int pitch, const RayHit& hit, const Uint8* colormap, int top, int height,
+	int first, int last) -> void
+{
+	// Rows [first, last) of the slice render_column_tile() would draw from top
+	const int level = {get_atlas_level(wall_atlas, height)};
+	const Uint32* texels = {get_atlas_column(wall_atlas, hit.wall - 1, level, hit.txt_x >> level)};
+	Uint32 txt_step = {static_cast<Uint32>(((TILE_HEIGHT >> level) << 16) / std::max(height, 1))};
+	Uint32 txt_pos = {static_cast<Uint32>(first - top) * txt_step};
+	for (int j = first; j < last; j++) {
+		Uint32 texel = {texels[txt_pos >> 16]};
+		if constexpr (Shaded)
+			column[j * pitch] = shade_texel(colormap, texel);
+		else
+			column[j * pitch] = texel & 0xFFFFFF;
+		txt_pos += txt_step;
+	}
+}
 
-			SDL_Rect destination_ceiling = {i, 0, 1, y};
-			SDL_RenderCopy (renderer, ceiling_texture, &rect, &destination_ceiling);
+template <bool Shaded>
+auto draw_plane_rows(Uint32* column, int pitch, double dir_x, double dir_y, int level, bool ceiling, int first,
+	int last) -> void
+{
+	// A level plane (the floor, the ceiling, or the top or underside of part of a wall) is seen at a row as far away as
+	// the floor or ceiling is there, scaled by how far the plane is from eye level, half way up. Each pixel takes its
+	// texture from the cell it falls in.
+	const double scale = {std::abs(GRID_FULL_HEIGHT - 2.0 * level) / GRID_FULL_HEIGHT};
+	const int rows = {static_cast<int>(row_distance.size())};
+	for (int j = first; j < last; j++) {
+		double dist = {row_distance[std::min(ceiling ? j : surface_height - 1 - j, rows - 1)] * scale};
+		double x = {camera_x + dir_x * dist};
+		double y = {camera_y + dir_y * dist};
+		int cell_x = {static_cast<int>(std::floor(x))};
+		int cell_y = {static_cast<int>(std::floor(y))};
+		GridCellStyle style = {get_grid_style(world_map, cell_x, cell_y)};
+		int texture = {ceiling ? style.ceiling : style.floor};
+		int tx = {static_cast<int>((x - cell_x) * TILE_WIDTH) & (TILE_WIDTH - 1)};
+		int ty = {static_cast<int>((y - cell_y) * TILE_HEIGHT) & (TILE_HEIGHT - 1)};
+		Uint32 texel = {texture != 0 ? get_atlas_column(wall_atlas, texture - 1, 0, tx)[ty] :
+			(ceiling ? ceiling_image : floor_image)->pixels[ty * TILE_WIDTH + tx]};
+		if constexpr (Shaded)
+			column[j * pitch] = shade_texel(get_colormap_row(*lighting, get_light_level(*lighting, dist)), texel);
+		else
+			column[j * pitch] = texel & 0xFFFFFF;
+	}
+}
+
+auto render_floor_rows(Framebuffer& target, int first, int last) -> void
+{
+	ProfileZone zone(ProfileStage::floor_draw);
+	Uint32* pixels = {target.pixels.data()};
+	const int pitch = {target.width};
+	const Uint32* pixsflr = {floor_image->pixels};
+	const Uint32* pixsclg = {ceiling_image->pixels};
+
+	// The unnormalised ray for column i is (1, scr_pts[i]) rotated by theta, so along a row the hit point moves by a
+	// constant amount per column. Track it in 16.16 texels; wrapping doesn't matter as only the low bits are used.
+	const double cos_theta = {view_cos};
+	const double sin_theta = {view_sin};
+	const double fixed_scale = {TILE_WIDTH * 65536.0};
+	const double d_scr = {scr_pts[1] - scr_pts[0]};
+
+	// Row j of the ceiling and row surface_height - 1 - j of the floor are the same distance away
+	for (int j = first; j < last; j++) {
+		double dist = {row_distance[j]};
+		const Uint8* colormap = {get_colormap_row(*lighting, get_light_level(*lighting, dist))};
+		Uint32 u = {static_cast<Uint32>(static_cast<Sint64>(std::floor((camera_x + dist * (cos_theta - sin_theta *
+			scr_pts[0])) * fixed_scale)))};
+		Uint32 v = {static_cast<Uint32>(static_cast<Sint64>(std::floor((camera_y + dist * (sin_theta + cos_theta *
+			scr_pts[0])) * fixed_scale)))};
+		Uint32 du = {static_cast<Uint32>(static_cast<Sint64>(std::floor(-dist * sin_theta * d_scr * fixed_scale)))};
+		Uint32 dv = {static_cast<Uint32>(static_cast<Sint64>(std::floor(dist * cos_theta * d_scr * fixed_scale)))};
+
+		Uint32* ceiling_row = {pixels + j * pitch};
+		Uint32* floor_row = {pixels + (surface_height - 1 - j) * pitch};
+		for (int i = 0; i < surface_width; i++) {
+			int texel = {static_cast<int>(((v >> 16) & (TILE_HEIGHT - 1)) * TILE_WIDTH +
+				((u >> 16) & (TILE_WIDTH - 1)))};
+			if (j < ceiling_rows[i])
+				ceiling_row[i] = shade_texel(colormap, pixsclg[texel]);
+			if (surface_height - 1 - j >= floor_top[i])
+				floor_row[i] = shade_texel(colormap, pixsflr[texel]);
+			u += du;
+			v += dv;
 		}
-    }
+	}
+
+}
+
+auto render_sprites(Framebuffer& target, int first, int last) -> void
+{
+	if (sprite_views.empty())
+		return;
+
+	ProfileZone zone(ProfileStage::sprite_draw);
+	Uint32* pixels = {target.pixels.data()};
+	const int pitch = {target.width};
+
+	// Nothing as far away as the furthest wall in the tile can show anywhere in it
+	double furthest = {0.0};
+	for (int i = first; i < last; i++)
+		furthest = std::max(furthest, wall_depth[i]);
+
+	// Furthest first, each a column at a time like a wall slice, skipping columns where it's behind the wall and
+	// texels that are see-through
+	for (const SpriteView& view : sprite_views) {
+		int view_first = {std::max(view.first, first)};
+		int view_last = {std::min(view.last, last)};
+		if (view.depth >= furthest || view_first >= view_last)
+			continue;
+
+		int height = {static_cast<int>(surface_height / view.depth)};
+		int y = {(surface_height - height) / 2};
+		const Uint8* colormap = {get_colormap_row(*lighting, get_light_level(*lighting, view.depth))};
+		const int level = {get_atlas_level(sprite_atlas, height)};
+		int y_start = {std::max(y, 0)};
+		int y_end = {std::min(y + height, surface_height)};
+		Uint32 txt_step = {static_cast<Uint32>(((SPRITE_TEXTURE_SIZE >> level) << 16) / std::max(height, 1))};
+		for (int i = view_first; i < view_last; i++) {
+			if (view.depth >= wall_depth[i])
+				continue;
+
+			// Behind walls with gaps in them, only the rows they leave open
+			int open_top = {0};
+			int open_bottom = {surface_height};
+			for (int k = 0; world_map.layered && k < layer_counts[i]; k++) {
+				const ColumnWindow& window = {column_windows[i * MAX_COLUMN_LAYERS + k]};
+				if (window.depth >= view.depth)
+					break;
+				open_top = window.top;
+				open_bottom = window.bottom;
+			}
+
+			int txt_x = {std::min(static_cast<int>((i - view.left) / view.width * SPRITE_TEXTURE_SIZE),
+				SPRITE_TEXTURE_SIZE - 1)};
+			const Uint32* texels = {get_atlas_column(sprite_atlas, view.texture, level, txt_x >> level)};
+			int j_start = {std::max(y_start, open_top)};
+			int j_end = {std::min(y_end, open_bottom)};
+			Uint32 txt_pos = {static_cast<Uint32>(j_start - y) * txt_step};
+			for (int j = j_start; j < j_end; j++) {
+				Uint32 texel = {texels[txt_pos >> 16]};
+				if ((texel >> 24) >= SPRITE_ALPHA_CUTOFF)
+					pixels[j * pitch + i] = shade_texel(colormap, texel);
+				txt_pos += txt_step;
+			}
+		}
+	}
+
+}
+
+auto present(const Framebuffer& source, TCODConsole* console, ConsoleCache& cache) -> void
+{
+	const Uint32* subcells = {source.pixels.data()};
+
+	// Average every framebuffer pixel under each subcell, unless they're one and the same
+	if (!subcell_pixels.empty()) {
+		ProfileZone zone(ProfileStage::downsample);
+		const Uint32* pixels = {source.pixels.data()};
+		for (int y = 0; y < SURFACE_HEIGHT; y++) {
+			int y_start = {present_y[y]};
+			int y_end = {std::max(present_y[y + 1], y_start + 1)};
+			for (int x = 0; x < SURFACE_WIDTH; x++) {
+				int x_start = {present_x[x]};
+				int x_end = {std::max(present_x[x + 1], x_start + 1)};
+				Uint32 r = {0};
+				Uint32 g = {0};
+				Uint32 b = {0};
+				for (int sy = y_start; sy < y_end; sy++) {
+					const Uint32* row = {pixels + sy * source.width};
+					for (int sx = x_start; sx < x_end; sx++) {
+						r += (row[sx] >> 16) & 0xFF;
+						g += (row[sx] >> 8) & 0xFF;
+						b += row[sx] & 0xFF;
+					}
+				}
+				Uint32 count = {static_cast<Uint32>((y_end - y_start) * (x_end - x_start))};
+				subcell_pixels[y * SURFACE_WIDTH + x] = ((r / count) << 16) | ((g / count) << 8) | (b / count);
+			}
+		}
+		subcells = subcell_pixels.data();
+	}
+
+	// Then split every 2x2 block whose subcells aren't the ones it was last drawn from between two colours and write it
+	// as a quadrant character, one cell in from the top left corner as the image blit used to be. Runs of blocks are
+	// compared at once, so a run where nothing changed costs a few vector compares.
+	ProfileZone zone(ProfileStage::console_fill);
+	const int cells = {WINDOW_WIDTH - 1};
+	int written = {0};
+	for (int y = 0; y + 1 < WINDOW_HEIGHT; y++) {
+		const Uint32* top = {subcells + 2 * y * SURFACE_WIDTH};
+		const Uint32* bottom = {top + SURFACE_WIDTH};
+		Uint32* shown_top = {cache.shown.data() + 2 * y * SURFACE_WIDTH};
+		Uint32* shown_bottom = {shown_top + SURFACE_WIDTH};
+		for (int first = 0; first < cells; first += CONSOLE_DIFF_CELLS) {
+			int last = {std::min(first + CONSOLE_DIFF_CELLS, cells)};
+			if (!is_subcell_span_changed(top, bottom, shown_top, shown_bottom, 2 * first, 2 * last))
+				continue;
+
+			for (int x = first; x < last; x++) {
+				const int i = {2 * x};
+				if (top[i] == shown_top[i] && top[i + 1] == shown_top[i + 1] && bottom[i] == shown_bottom[i] &&
+					bottom[i + 1] == shown_bottom[i + 1])
+					continue;
+
+				write_console_cell(console, cache, x + 1, y + 1, top + i, bottom + i);
+				shown_top[i] = top[i];
+				shown_top[i + 1] = top[i + 1];
+				shown_bottom[i] = bottom[i];
+				shown_bottom[i + 1] = bottom[i + 1];
+				written++;
+			}
+		}
+	}
+	cache.written = written;
 }
 
-auto update_ticks() -> void
+auto reset_console_cache(ConsoleCache& cache) -> void
 {
-	int ticks_now = {SDL_GetTicks()};
-	diff_ticks = ticks_now - ticks;
-	ticks = ticks_now;
+	// Nothing counts as shown, so the next present() writes every cell
+	cache.shown.assign(SURFACE_WIDTH * SURFACE_HEIGHT, CONSOLE_UNSHOWN);
+	cache.overlaid.assign(WINDOW_WIDTH * WINDOW_HEIGHT, 0);
+	cache.written = 0;
 }
 
-auto close() -> void
+auto is_subcell_span_changed(const Uint32* top, const Uint32* bottom, const Uint32* shown_top,
+	const Uint32* shown_bottom, int first, int last) -> bool
 {
-    if (renderer != nullptr)
-        SDL_DestroyRenderer(renderer);
-    if (working_surface != nullptr)
-        SDL_FreeSurface(working_surface);
-    if (working_texture != nullptr)
-        SDL_DestroyTexture(working_texture);
+	int i = {first};
+#if defined(__SSE2__)
+	// Four subcells of each row at a time
+	__m128i same = {_mm_set1_epi32(-1)};
+	for (; i + 4 <= last; i += 4) {
+		same = _mm_and_si128(same, _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(shown_top + i))));
+		same = _mm_and_si128(same, _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(shown_bottom + i))));
+	}
+	if (_mm_movemask_epi8(same) != 0xFFFF)
+		return true;
+#endif
 
-    IMG_Quit();
-    SDL_Quit();
-    TCOD_quit();
+	Uint32 changed = {0};
+	for (; i < last; i++)
+		changed |= (top[i] ^ shown_top[i]) | (bottom[i] ^ shown_bottom[i]);
+
+	return changed != 0;
+}
+
+auto write_console_cell(TCODConsole* console, const ConsoleCache& cache, int x, int y, const Uint32* top,
+	const Uint32* bottom) -> void
+{
+	// A cell under the HUD keeps its character and colour, as printing over the view always has
+	SubcellGlyph glyph = {get_subcell_glyph(top, bottom)};
+	TCODColor background((glyph.background >> 16) & 0xFF, (glyph.background >> 8) & 0xFF, glyph.background & 0xFF);
+	if (cache.overlaid[y * WINDOW_WIDTH + x] != 0)
+		console->setCharBackground(x, y, background);
+	else
+		console->putCharEx(x, y, SUBCELL_CHARACTERS[static_cast<int>(glyph.shape)],
+			TCODColor((glyph.foreground >> 16) & 0xFF, (glyph.foreground >> 8) & 0xFF, glyph.foreground & 0xFF),
+			background);
 }
 
-auto update_world() -> void
+auto set_console_hud(ConsoleCache& cache, TCODConsole* console, HudPainter paint) -> void
 {
-    double coss = {std::cos(theta)};
-	double sinn = {std::sin(theta)};
+	// The HUD is painted onto a layer of nothing but NUL characters, so every cell it writes to stands out, spaces
+	// included
+	if (cache.hud == nullptr)
+		cache.hud = std::make_unique<TCODConsole>(WINDOW_WIDTH, WINDOW_HEIGHT);
+	for (int y = 0; y < WINDOW_HEIGHT; y++)
+		for (int x = 0; x < WINDOW_WIDTH; x++)
+			cache.hud->setChar(x, y, 0);
+	paint(cache.hud.get());
+
+	// Copy it over the view once. Cells it no longer covers go back to the view as last shown, or to blank outside it.
+	for (int y = 0; y < WINDOW_HEIGHT; y++) {
+		for (int x = 0; x < WINDOW_WIDTH; x++) {
+			Uint8& overlaid = {cache.overlaid[y * WINDOW_WIDTH + x]};
+			bool covered = {cache.hud->getChar(x, y) != 0};
+			bool uncovered = {overlaid != 0 && !covered};
+			overlaid = covered;
+			if (covered) {
+				console->setChar(x, y, cache.hud->getChar(x, y));
+				console->setCharForeground(x, y, cache.hud->getCharForeground(x, y));
+			} else if (uncovered && x > 0 && y > 0) {
+				const Uint32* top = {cache.shown.data() + 2 * (y - 1) * SURFACE_WIDTH + 2 * (x - 1)};
+				write_console_cell(console, cache, x, y, top, top + SURFACE_WIDTH);
+			} else if (uncovered)
+				console->setChar(x, y, ' ');
+		}
+	}
+}
 
-	// For when walking backwards
-	int dsgn = {sign(speed)};
-	double sx = {sign(coss) * dsgn};
-	double sy = {sign(sinn) * dsgn};
+auto draw_credits(TCODConsole* console) -> void
+{
+	console->setDefaultForeground(TCODColor::yellow);
+	console->printf(2, WINDOW_HEIGHT - 5, "Libtcod Raycaster Coplayer_yright (C) 2019 Dave Moore");
+	console->setDefaultForeground(TCODColor::orange);
+	console->printf(2, WINDOW_HEIGHT - 3, "davemoore22@gmail.com");
+	console->setDefaultForeground(TCODColor::red);
+	console->printf(2, WINDOW_HEIGHT - 1, "Code released under MIT License");
+	console->setDefaultForeground(TCODColor::silver);
+	console->printf(70, WINDOW_HEIGHT - 5, "Based upon 3D Raycaster by Timmos");
+	console->setDefaultForeground(TCODColor::cyan);
+	console->printf(70, WINDOW_HEIGHT - 3, "https://github.com/T1mmos/raycaster-sdl");
+	console->setDefaultForeground(TCODColor::silver);
+	console->print(70, WINDOW_HEIGHT - 1, LIBTCOD_VERSION);
+}
 
-	double dt = {(diff_ticks / 1000.0)};
-	double dp = {dt * speed};
-	double dx = {coss * dp};
-	double dy = {sinn * dp};
+auto draw_profile_overlay(TCODConsole* console) -> void
+{
+	// Rolling averages of every stage in two columns over the bottom five rows. The render stages are summed over
+	// every render thread.
+	ProfileZone zone(ProfileStage::console_fill);
+	const int rows = {5};
+	for (int stage = 0; stage < PROFILE_STAGES; stage++) {
+		ProfileStage timed = {static_cast<ProfileStage>(stage)};
+		console->setDefaultForeground(timed == ProfileStage::frame ? TCODColor::yellow : TCODColor::silver);
+		console->printf(2 + stage / rows * 68, WINDOW_HEIGHT - rows + stage % rows, "%-14s %8.3f ms",
+			get_profile_stage_name(timed), get_profile_average(timed));
+	}
+}
 
-	double player_x_new = {player_x + dx};
-	double player_y_new = {player_y + dy};
+auto interpolate_camera(double alpha) -> CameraState
+{
+	return {previous_x + (player_x - previous_x) * alpha, previous_y + (player_y - previous_y) * alpha,
+		previous_theta + (theta - previous_theta) * alpha, &light_tables[lighting_profile]};
+}
 
-	// Handle collision detection
-	double cx_b = {player_x_new - sx * MIN_DIST};
-	double cx_f = {player_x_new + sx * MIN_DIST};
-	double cy_b = {player_y_new - sy * MIN_DIST};
-	double cy_f = {player_y_new + sy * MIN_DIST};
-	if (!is_colliding(cx_f, cy_f) &&	!is_colliding(cx_b, cy_f) && !is_colliding(cx_f, cy_b)) {
+auto set_camera(const CameraState& camera) -> void
+{
+	camera_x = camera.x;
+	camera_y = camera.y;
+	camera_theta = camera.theta;
+	lighting = camera.lighting;
+}
 
-		// Direction where player is looking at
-		player_x = player_x_new;
-		player_y = player_y_new;
-	} else if (!is_colliding(cx_f, player_y + MIN_DIST) && !is_colliding(cx_f, player_y - MIN_DIST)) {
+auto post_camera(const CameraState& camera) -> void
+{
+	{
+		std::lock_guard<std::mutex> lock(camera_mutex);
+		posted_camera = camera;
+		camera_pending = true;
+	}
+	camera_posted.notify_one();
+}
 
-		// X-Direction
-		player_x = player_x_new;
-	} else if (!is_colliding(player_x + MIN_DIST, cy_f) && 	!is_colliding(player_x - MIN_DIST, cy_f)) {
+auto render_frames() -> void
+{
+	// Render the newest camera posted (any posted while a frame was being rendered are skipped), unless it would give
+	// the same frame as last time
+	while (true) {
+		CameraState camera = {};
+		{
+			std::unique_lock<std::mutex> lock(camera_mutex);
+			camera_posted.wait(lock, [] { return camera_pending || render_stopping; });
+			if (render_stopping)
+				return;
+			camera = posted_camera;
+			camera_pending = false;
+		}
 
-		// Y-Direction
-		player_y = player_y_new;
+		set_camera(camera);
+		if (!is_frame_unchanged()) {
+			render(frames->get_back());
+			frames->publish();
+		}
 	}
+}
+
+auto close() -> void
+{
+	render_pool.reset();
+	floor_image.reset();
+	ceiling_image.reset();
+	resources.reset();
+
+    IMG_Quit();
+    SDL_Quit();
+    TCOD_quit();
+}
+
+auto update_world(double dt) -> void
+{
+	// Keep where the player was for the camera to interpolate from
+	previous_x = player_x;
+	previous_y = player_y;
+	previous_theta = theta;
+
+	// Move the player (a circle of radius MIN_DIST) as far as the walls allow, sliding along any it walks into
+	double dp = {dt * speed};
+	sweep_circle(world_map, player_x, player_y, MIN_DIST, std::cos(theta) * dp, std::sin(theta) * dp);
 
-    // Otherwise no movement is possible (we are in a corner)
     double diffTurn = {dt * turn};
     theta += diffTurn;
 }
 
+auto print_usage(const char* program) -> void
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		"  --map file               map to load (res/maps/world.map)\n"
+		"  --sprites file           sprites to place (res/maps/world.sprites)\n"
+		"  --resolution WxH         render at another size\n"
+		"  --threads N              render threads (one per hardware thread)\n"
+		"  --fps N                  frame rate cap, 0 for none (60)\n"
+		"  --floor-kernel name      scalar, sse2 or avx2\n"
+		"  --floor-mode name        columns or rows\n"
+		"  --traversal name         legacy, dda or skipping\n"
+		"  --lighting name          lighting profile to start with\n"
+		"  --no-frame-cache         render and cast every frame in full\n"
+		"  --no-pipeline            render and present on the main thread\n"
+		"  --no-asset-cache         neither read nor write the asset cache\n"
+		"  --no-pvs                 do not cull sprites by visible sets\n"
+		"  --profile                show the stage profiler\n"
+		"  --trace file             write a Chrome trace on exit\n"
+		"  --check-traversal        compare the ray walks and exit\n"
+		"  --benchmark              run the benchmark lap and exit\n"
+		"  --frames N               benchmark frames\n"
+		"  --with-present           include presenting in the benchmark\n"
+		"  --pipeline               benchmark with the render thread\n"
+		"  --map-size N             benchmark on an N by N map\n"
+		"  --sprite-count N         benchmark with N scattered sprites\n"
+		"  --query-benchmark        time a batch of ray queries and exit\n"
+		"  --rays N                 rays in the query batch (100000)\n"
+		"  --entity-benchmark       time entity movement and exit\n"
+		"  --entities N             entities to move (10000)" << std::endl;
+}
+
 auto main(int argc, char* args[]) -> int
 {
-    // Initialise
-	SDL_Color rgb = {};
-	Uint32 data = {};
-	std::string version = {"Powered by Libtcod " + std::to_string(TCOD_MAJOR_VERSION) + "." +
-		std::to_string(TCOD_MINOR_VERSION) + "." + std::to_string(TCOD_PATCHLEVEL)};
+	// Command Line Options
+	bool benchmark = {false};
+	int benchmark_frames = {0};
+	bool benchmark_present = {false};
+	int benchmark_map_size = {0};
+	bool benchmark_pipeline = {false};
+	int benchmark_sprites = {0};
+	bool traversal_check = {false};
+	bool query_benchmark = {false};
+	int query_rays = {100000};
+	bool entity_benchmark = {false};
+	int entity_count = {10000};
+	std::string map_file = {"res/maps/world.map"};
+	std::string sprite_file = {"res/maps/world.sprites"};
+	bool profile_overlay = {false};
+	std::string trace_file = {};
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string option = {args[i]};
+			if (option == "--benchmark")
+				benchmark = true;
+			else if (option == "--frames" && i + 1 < argc)
+				benchmark_frames = std::stoi(args[++i]);
+			else if (option == "--with-present")
+				benchmark_present = true;
+			else if (option == "--map-size" && i + 1 < argc)
+				benchmark_map_size = std::stoi(args[++i]);
+			else if (option == "--map" && i + 1 < argc)
+				map_file = args[++i];
+			else if (option == "--sprites" && i + 1 < argc)
+				sprite_file = args[++i];
+			else if (option == "--sprite-count" && i + 1 < argc)
+				benchmark_sprites = std::stoi(args[++i]);
+			else if (option == "--no-frame-cache")
+				frame_cache = false;
+			else if (option == "--no-asset-cache")
+				asset_cache = false;
+			else if (option == "--fps" && i + 1 < argc)
+				frame_cap = std::stoi(args[++i]);
+			else if (option == "--resolution" && i + 1 < argc) {
+
+				// WxH, kept to an even height as the floor is drawn as the ceiling mirrored about the horizon
+				std::string size = {args[++i]};
+				std::size_t x = {size.find('x')};
+				if (x == std::string::npos) {
+					print_usage(args[0]);
+					return -1;
+				}
+				surface_width = std::max(std::stoi(size.substr(0, x)), 2);
+				surface_height = std::max(std::stoi(size.substr(x + 1)) / 2 * 2, 2);
+			} else if (option == "--no-pipeline")
+				pipelined = false;
+			else if (option == "--pipeline")
+				benchmark_pipeline = true;
+			else if (option == "--threads" && i + 1 < argc)
+				render_threads = std::stoi(args[++i]);
+			else if (option == "--floor-kernel" && i + 1 < argc) {
+				std::string name = {args[++i]};
+				for (FloorKernel kernel : {FloorKernel::scalar, FloorKernel::sse2, FloorKernel::avx2})
+					if (name == get_floor_kernel_name(kernel))
+						floor_kernel = kernel;
+			} else if (option == "--floor-mode" && i + 1 < argc) {
+				std::string name = {args[++i]};
+				floor_mode = name == "rows" ? FloorMode::rows : FloorMode::columns;
+			} else if (option == "--traversal" && i + 1 < argc) {
+				std::string name = {args[++i]};
+				for (Traversal choice : {Traversal::legacy, Traversal::dda, Traversal::skipping})
+					if (name == get_traversal_name(choice))
+						traversal = choice;
+			} else if (option == "--check-traversal")
+				traversal_check = true;
+			else if (option == "--lighting" && i + 1 < argc) {
+				std::string name = {args[++i]};
+				for (std::size_t profile = 0; profile < sizeof(LIGHTING_PROFILES) / sizeof(LIGHTING_PROFILES[0]);
+					profile++)
+					if (name == LIGHTING_PROFILES[profile].name)
+						lighting_profile = profile;
+			} else if (option == "--profile")
+				profile_overlay = true;
+			else if (option == "--trace" && i + 1 < argc)
+				trace_file = args[++i];
+			else if (option == "--query-benchmark")
+				query_benchmark = true;
+			else if (option == "--rays" && i + 1 < argc)
+				query_rays = std::max(std::stoi(args[++i]), 1);
+			else if (option == "--no-pvs")
+				use_visibility = false;
+			else if (option == "--entity-benchmark")
+				entity_benchmark = true;
+			else if (option == "--entities" && i + 1 < argc)
+				entity_count = std::max(std::stoi(args[++i]), 1);
+			else {
+
+				// Anything unknown, or an option missing its value
+				print_usage(args[0]);
+				return -1;
+			}
+		}
+	} catch (const std::invalid_argument&) {
+		print_usage(args[0]);
+		return -1;
+	} catch (const std::out_of_range&) {
+		print_usage(args[0]);
+		return -1;
+	}
+
+	// Load the Map
+	world_map = load_grid_map(map_file.c_str());
+	if (world_map.width == 0)
+		return -1;
+	player_x = world_map.start_x;
+	player_y = world_map.start_y;
+	previous_x = player_x;
+	previous_y = player_y;
+	camera_x = player_x;
+	camera_y = player_y;
+
+	if (traversal_check) {
+		int rays = {0};
+		int corners = {0};
+		int mismatches = {check_traversal(world_map, &rays, &corners)};
+		std::cout << "Traversal check: " << rays << " rays, " << mismatches << " mismatches, " << corners <<
+			" through cell corners" << std::endl;
+		return mismatches == 0 ? 0 : 1;
+	}
 
-	// libtcod off-screen buffer
-	std::unique_ptr<TCODConsole> offscreen = std::make_unique<TCODConsole>(SURFACE_WIDTH, SURFACE_HEIGHT);
+	// Batch ray queries and entity movement need nothing but the map
+	unsigned int threads = {render_threads != 0 ? render_threads : std::max(std::thread::hardware_concurrency(), 1u)};
+	if (query_benchmark)
+		return run_query_benchmark(query_rays, benchmark_map_size, threads);
+	if (entity_benchmark)
+		return run_entity_benchmark(entity_count, benchmark_map_size, threads);
 
-	if (initialise () < 0)
+	if (initialise (benchmark) < 0)
         return -1;
 
-	// Input Loop
+	// Nothing in the map can name a texture past the last one loaded
+	if (get_grid_texture_count(world_map) > get_atlas_count(wall_atlas)) {
+		std::cout << "Map " << map_file << " uses " << get_grid_texture_count(world_map) <<
+			" wall textures but only " << get_atlas_count(wall_atlas) << " are loaded!" << std::endl;
+		return -1;
+	}
+
+	prepare_visibility(map_file);
+
+	// Sprites go with the map, so they can only be placed once their textures are known
+	sprites = load_sprites(sprite_file.c_str(), get_atlas_count(sprite_atlas));
+
+	// Headless benchmark instead of the demo
+	if (benchmark) {
+		int result = {run_benchmark(benchmark_frames, benchmark_present, benchmark_map_size, benchmark_pipeline,
+			benchmark_sprites, trace_file.empty() ? nullptr : trace_file.c_str())};
+		close();
+		return result;
+	}
+
+	// Main Loop: the world is updated in fixed ticks, as many as the time since the last frame calls for, and each
+	// frame is drawn part way between the last two ticks according to the time left over
 	bool quit = {false};
 	TCOD_key_t key_pressed = {};
+	const Sint64 tick_length = {1000000000 / TICK_RATE};
+	Sint64 tick_lag = {0};
+	Sint64 frame_started = {get_nanoseconds()};
+	std::thread render_thread = {};
+	if (profile_overlay || !trace_file.empty())
+		start_profiler(trace_file.empty() ? 0 : PROFILE_TRACE_EVENTS);
+
+	// The root console starts out blank, with the HUD drawn over it once
+	reset_console_cache(console_cache);
+	set_console_hud(console_cache, TCODConsole::root, profile_overlay ? draw_profile_overlay : draw_credits);
+	if (pipelined) {
+		frames = std::make_unique<TripleBuffer<Framebuffer>>(framebuffer);
+		render_thread = std::thread(render_frames);
+	}
 
 	while (!quit) {
+		Sint64 now = {get_nanoseconds()};
+		tick_lag += now - frame_started;
+		frame_started = now;
+
+		// Get keypress (for anything that happens once per press)
+		{
+			ProfileZone zone(ProfileStage::input);
+			TCODSystem::checkForEvent(TCOD_EVENT_KEY_PRESS, &key_pressed, nullptr);
+			if (key_pressed.vk == TCODK_ESCAPE)
+				quit = true;
+			else if (key_pressed.vk == TCODK_CHAR && (key_pressed.c == 'l' || key_pressed.c == 'L')) {
+				lighting_profile = (lighting_profile + 1) % light_tables.size();
+			} else if (key_pressed.vk == TCODK_CHAR && (key_pressed.c == 'p' || key_pressed.c == 'P')) {
+
+				// The profiler only runs while something is using it; a trace keeps it running throughout
+				profile_overlay = !profile_overlay;
+				if (trace_file.empty() && profile_overlay)
+					start_profiler(0);
+				else if (trace_file.empty())
+					stop_profiler();
+				set_console_hud(console_cache, TCODConsole::root,
+					profile_overlay ? draw_profile_overlay : draw_credits);
+			}
 
-		// Get keypress
-		TCODSystem::checkForEvent(TCOD_EVENT_KEY_PRESS, &key_pressed, nullptr);
-
-		// Handle Movement
-		speed = 0.0;
-		turn = 0.0;
-		switch (key_pressed.vk) {
-			case TCODK_KP8:
-			case TCODK_UP:
+			// Handle Movement (for as long as the keys are held down)
+			speed = 0.0;
+			turn = 0.0;
+			if (TCODConsole::isKeyPressed(TCODK_UP) || TCODConsole::isKeyPressed(TCODK_KP8))
 				speed += DEFAULT_SPEED;
-				break;
-			case TCODK_KP2:
-			case TCODK_DOWN:
+			if (TCODConsole::isKeyPressed(TCODK_DOWN) || TCODConsole::isKeyPressed(TCODK_KP2))
 				speed -= DEFAULT_SPEED;
-				break;
-			case TCODK_KP4:
-			case TCODK_LEFT:
+			if (TCODConsole::isKeyPressed(TCODK_LEFT) || TCODConsole::isKeyPressed(TCODK_KP4))
 				turn += TURN_SPEED;
-				break;
-			case TCODK_KP6:
-			case TCODK_RIGHT:
+			if (TCODConsole::isKeyPressed(TCODK_RIGHT) || TCODConsole::isKeyPressed(TCODK_KP6))
 				turn -= TURN_SPEED;
-				break;
-			default:
-				break;
 		}
 
 		// Update World
-        update_ticks();
-        update_world();
-
-		// Clear renderer and render
-        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderTarget(renderer, working_texture);
-        SDL_RenderClear(renderer);
-        render();
-
-        // Grab the render contents (WARNING: THIS IS VERY VERY VERY HIDEOUSLY SLOW!)
-		SDL_SetRenderTarget(renderer, working_texture_streaming);
-		SDL_RenderCopy(renderer, working_texture, NULL, NULL);
-		SDL_Surface *source_for_libtcod = SDL_CreateRGBSurface(0, SURFACE_WIDTH , SURFACE_HEIGHT, 32, 0x00ff0000,
-			0x0000ff00, 0x000000ff, 0xff000000);
-		SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGB888, source_for_libtcod->pixels,
-			source_for_libtcod->pitch);
-
-        // Clear libtcod screen and buffer
-        TCODConsole::root->clear();
-        offscreen->setDefaultBackground(TCODColor::black);
-        offscreen->clear();
-
-        // Populate libtcod offscreen
-        for (int x = 0; x < SURFACE_WIDTH; x++) {
-			for (int y = 0; y < SURFACE_HEIGHT; y++) {
-				data = get_pixel(source_for_libtcod, x, y);
-				SDL_GetRGB(data, source_for_libtcod->format, &rgb.r, &rgb.g, &rgb.b);
-				TCODColor temp(rgb.r, rgb.g, rgb.b);
-                offscreen->setCharBackground(x, y, temp);
-				offscreen->setCharForeground(x, y, temp);
-                offscreen->putChar(x, y, 32);
+		int ticks = {0};
+		{
+			ProfileZone zone(ProfileStage::update);
+			while (tick_lag >= tick_length && ticks < MAX_TICKS_PER_FRAME) {
+				update_world(1.0 / TICK_RATE);
+				tick_lag -= tick_length;
+				ticks++;
+			}
+		}
+		tick_lag = std::min(tick_lag, tick_length);
+		CameraState camera = {interpolate_camera(1.0 * tick_lag / tick_length)};
+
+		if (pipelined) {
+
+			// Hand the camera over to the render thread and show the newest frame it has finished
+			post_camera(camera);
+			const Framebuffer* frame = {frames->acquire()};
+			if (frame != nullptr)
+				present(*frame, TCODConsole::root, console_cache);
+		} else {
+
+			// Render into the framebuffer and then to libtcod, unless nothing that shows has changed since the last
+			// frame
+			set_camera(camera);
+			if (!is_frame_unchanged()) {
+				render(framebuffer);
+				present(framebuffer, TCODConsole::root, console_cache);
 			}
-        }
-
-        // Note that using the alternate refreshConsole method crashes so a new image needs to be created every frame
-
-		// Render to libtcod
-		std::unique_ptr<TCODImage> image_to_render = std::make_unique<TCODImage>(offscreen.get());
-		image_to_render->scale(WINDOW_WIDTH * 2, WINDOW_HEIGHT * 2);
-		image_to_render->blit2x(TCODConsole::root, 1, 1);
-
-		// Update Text
-		TCODConsole::root->setDefaultForeground(TCODColor::yellow);
-		TCODConsole::root->printf(2, WINDOW_HEIGHT - 5, "Libtcod Raycaster Coplayer_yright (C) 2019 Dave Moore");
-		TCODConsole::root->setDefaultForeground(TCODColor::orange);
-		TCODConsole::root->printf(2, WINDOW_HEIGHT - 3, "davemoore22@gmail.com");
-		TCODConsole::root->setDefaultForeground(TCODColor::red);
-		TCODConsole::root->printf(2, WINDOW_HEIGHT - 1, "Code released under MIT License");
-		TCODConsole::root->setDefaultForeground(TCODColor::silver);
-		TCODConsole::root->printf(70, WINDOW_HEIGHT - 5, "Based upon 3D Raycaster by Timmos");
-		TCODConsole::root->setDefaultForeground(TCODColor::cyan);
-		TCODConsole::root->printf(70, WINDOW_HEIGHT - 3, "https://github.com/T1mmos/raycaster-sdl");
-		TCODConsole::root->setDefaultForeground(TCODColor::silver);
-		TCODConsole::root->print(70, WINDOW_HEIGHT - 1, version);
-		TCODConsole::root->flush();
+		}
+
+		// The credits stay put from frame to frame, but the profiler's averages are rewritten every frame while shown
+		if (profile_overlay)
+			draw_profile_overlay(TCODConsole::root);
+		{
+			ProfileZone zone(ProfileStage::flush);
+			TCODConsole::root->flush();
+		}
+
+		// Everything up to here counts towards the frame, but not the sleep
+		if (is_profiling())
+			record_profile(ProfileStage::frame, now, get_nanoseconds());
+		end_profile_frame();
+
+		// Sleep away whatever is left of the frame
+		if (frame_cap > 0) {
+			Sint64 remaining = {frame_started + 1000000000 / frame_cap - get_nanoseconds()};
+			if (remaining > 0)
+				std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+		}
     }
 
+	if (render_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(camera_mutex);
+			render_stopping = true;
+		}
+		camera_posted.notify_one();
+		render_thread.join();
+	}
+
+	if (!trace_file.empty()) {
+		stop_profiler();
+		save_profile_trace(trace_file.c_str());
+	}
+
     close();
     return 0;
 }
@@ -0,0 +1,259 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+
+#include "movement.hpp"
+
+namespace {
+
+	const int MAX_SLIDES = {3};				// Walls met in one move before the rest of it is given up
+	const double WALL_SKIN = {1e-6};		// Gap left between a circle and the wall it stopped at
+
+	// When (0..1 of the way along the move) a circle moving by (dx, dy) first touches a wall cell, and which way the
+	// wall pushes back. A circle already touching the cell only counts if it's moving further in.
+	auto sweep_circle_cell(double x, double y, double radius, double dx, double dy, int cell_x, int cell_y,
+		double& t, double& normal_x, double& normal_y) -> bool
+	{
+		double gap_x = {x - std::clamp(x, 1.0 * cell_x, cell_x + 1.0)};
+		double gap_y = {y - std::clamp(y, 1.0 * cell_y, cell_y + 1.0)};
+		double gap = {std::hypot(gap_x, gap_y)};
+		if (gap <= radius) {
+			if (gap == 0 || dx * gap_x + dy * gap_y >= 0)
+				return false;
+			t = 0;
+			normal_x = gap_x / gap;
+			normal_y = gap_y / gap;
+			return true;
+		}
+
+		// The centre meets the cell grown by the radius on every side, first along whichever axis it enters last
+		double enter = {0};
+		double leave = {1};
+		bool across_x = {false};
+		for (int axis = 0; axis < 2; axis++) {
+			double from = {axis == 0 ? x : y};
+			double by = {axis == 0 ? dx : dy};
+			double low = {(axis == 0 ? cell_x : cell_y) - radius};
+			double high = {(axis == 0 ? cell_x : cell_y) + 1 + radius};
+			if (by == 0) {
+				if (from < low || from > high)
+					return false;
+				continue;
+			}
+			double near = {((by > 0 ? low : high) - from) / by};
+			double far = {((by > 0 ? high : low) - from) / by};
+			if (near > enter) {
+				enter = near;
+				across_x = axis == 0;
+			}
+			leave = std::min(leave, far);
+		}
+		if (enter > leave)
+			return false;
+
+		// Along a face, that's where it touches
+		double at_x = {x + dx * enter};
+		double at_y = {y + dy * enter};
+		if ((at_x >= cell_x && at_x <= cell_x + 1) || (at_y >= cell_y && at_y <= cell_y + 1)) {
+			t = enter;
+			normal_x = across_x ? (dx > 0 ? -1 : 1) : 0;
+			normal_y = across_x ? 0 : (dy > 0 ? -1 : 1);
+			return true;
+		}
+
+		// Off the end of a face the grown cell's corner is rounded, so it's the corner's circle that's met, if at all
+		double corner_x = {at_x < cell_x ? 1.0 * cell_x : cell_x + 1.0};
+		double corner_y = {at_y < cell_y ? 1.0 * cell_y : cell_y + 1.0};
+		double to_x = {x - corner_x};
+		double to_y = {y - corner_y};
+		double a = {dx * dx + dy * dy};
+		double b = {to_x * dx + to_y * dy};
+		double c = {to_x * to_x + to_y * to_y - radius * radius};
+		double discriminant = {b * b - a * c};
+		if (b >= 0 || discriminant < 0)
+			return false;
+		t = std::max((-b - std::sqrt(discriminant)) / a, 0.0);
+		if (t >= 1)
+			return false;
+		double touch_x = {to_x + dx * t};
+		double touch_y = {to_y + dy * t};
+		double length = {std::hypot(touch_x, touch_y)};
+		normal_x = touch_x / length;
+		normal_y = touch_y / length;
+
+		return true;
+	}
+
+	// Where entity i gets to this tick
+	auto move_entity(const GridMap& map, const Entities& entities, std::size_t i, double dt, double& x,
+		double& y) -> void
+	{
+		// Half of every overlap with another entity is made up by moving this one directly away from it (the other
+		// one moves the other half). Entities exactly on top of each other are split along x by their order.
+		const SpatialHash& hash = {entities.hash};
+		x = entities.x[i];
+		y = entities.y[i];
+		double radius = {entities.radius[i]};
+		double push_x = {0};
+		double push_y = {0};
+		int cell_x = {get_spatial_hash_cell(x)};
+		int cell_y = {get_spatial_hash_cell(y)};
+		unsigned int visited[9] = {};
+		int visits = {0};
+		for (int near_y = cell_y - 1; near_y <= cell_y + 1; near_y++) {
+			for (int near_x = cell_x - 1; near_x <= cell_x + 1; near_x++) {
+
+				// Two of the cells around can share a bucket, which only wants looking through once
+				unsigned int bucket = {get_spatial_hash_bucket(hash, near_x, near_y)};
+				if (std::find(visited, visited + visits, bucket) != visited + visits)
+					continue;
+				visited[visits++] = bucket;
+				for (int entry = hash.starts[bucket]; entry < hash.starts[bucket + 1]; entry++) {
+					std::size_t j = {static_cast<std::size_t>(hash.entries[entry])};
+					double gap_x = {x - entities.x[j]};
+					double gap_y = {y - entities.y[j]};
+					double reach = {radius + entities.radius[j]};
+					double gap = {gap_x * gap_x + gap_y * gap_y};
+					if (j == i || gap >= reach * reach)
+						continue;
+					gap = std::sqrt(gap);
+					if (gap > 0) {
+						push_x += gap_x / gap * (reach - gap) / 2;
+						push_y += gap_y / gap * (reach - gap) / 2;
+					} else
+						push_x += (i < j ? -reach : reach) / 2;
+				}
+			}
+		}
+
+		sweep_circle(map, x, y, radius, entities.vel_x[i] * dt + push_x, entities.vel_y[i] * dt + push_y);
+	}
+}
+
+auto add_entity(Entities& entities, double x, double y, double radius) -> int
+{
+	entities.x.push_back(x);
+	entities.y.push_back(y);
+	entities.vel_x.push_back(0);
+	entities.vel_y.push_back(0);
+	entities.radius.push_back(std::min(radius, ENTITY_MAX_RADIUS));
+
+	return static_cast<int>(entities.x.size()) - 1;
+}
+
+auto build_spatial_hash(SpatialHash& hash, const std::vector<double>& x, const std::vector<double>& y) -> void
+{
+	// Twice as many buckets as entities keeps runs short. Entities are counted into buckets and then placed in
+	// bucket order, last first, so that each bucket's run ends up in entity order.
+	std::size_t count = {x.size()};
+	std::size_t size = {1};
+	while (size < 2 * count)
+		size <<= 1;
+	hash.mask = static_cast<unsigned int>(size - 1);
+	hash.starts.assign(size + 1, 0);
+	hash.entries.resize(count);
+	hash.buckets.resize(count);
+	for (std::size_t i = 0; i < count; i++) {
+		hash.buckets[i] = static_cast<int>(get_spatial_hash_bucket(hash, get_spatial_hash_cell(x[i]),
+			get_spatial_hash_cell(y[i])));
+		hash.starts[hash.buckets[i]]++;
+	}
+	for (std::size_t bucket = 1; bucket <= size; bucket++)
+		hash.starts[bucket] += hash.starts[bucket - 1];
+	for (std::size_t i = count; i-- > 0;)
+		hash.entries[--hash.starts[hash.buckets[i]]] = static_cast<int>(i);
+}
+
+auto sweep_circle(const GridMap& map, double& x, double& y, double radius, double dx, double dy) -> bool
+{
+	bool touched = {false};
+	for (int slide = 0; slide < MAX_SLIDES && (dx != 0 || dy != 0); slide++) {
+
+		// Far enough from any wall that the whole move is clear (every cell it could touch is within reach of the
+		// one it starts in)
+		int reach = {static_cast<int>(std::ceil(radius + std::max(std::abs(dx), std::abs(dy))))};
+		int from_x = {static_cast<int>(std::floor(x))};
+		int from_y = {static_cast<int>(std::floor(y))};
+		if (get_grid_clearance(map, from_x, from_y) > reach) {
+			x += dx;
+			y += dy;
+			return touched;
+		}
+
+		// Otherwise find the first wall it would touch among the cells under the whole move
+		double first = {1};
+		double normal_x = {0};
+		double normal_y = {0};
+		int min_x = {static_cast<int>(std::floor(std::min(x, x + dx) - radius))};
+		int max_x = {static_cast<int>(std::floor(std::max(x, x + dx) + radius))};
+		int min_y = {static_cast<int>(std::floor(std::min(y, y + dy) - radius))};
+		int max_y = {static_cast<int>(std::floor(std::max(y, y + dy) + radius))};
+		for (int cell_y = min_y; cell_y <= max_y; cell_y++) {
+			for (int cell_x = min_x; cell_x <= max_x; cell_x++) {
+				double t = {0};
+				double wall_x = {0};
+				double wall_y = {0};
+				if (get_grid_cell(map, cell_x, cell_y) != 0 &&
+					sweep_circle_cell(x, y, radius, dx, dy, cell_x, cell_y, t, wall_x, wall_y) && t < first) {
+					first = t;
+					normal_x = wall_x;
+					normal_y = wall_y;
+				}
+			}
+		}
+		if (first >= 1) {
+			x += dx;
+			y += dy;
+			return touched;
+		}
+
+		// Stop just short of it, and slide along it with whatever of the move doesn't go into it
+		touched = true;
+		x += dx * first + normal_x * WALL_SKIN;
+		y += dy * first + normal_y * WALL_SKIN;
+		dx *= 1 - first;
+		dy *= 1 - first;
+		double into = {std::min(dx * normal_x + dy * normal_y, 0.0)};
+		dx -= normal_x * into;
+		dy -= normal_y * into;
+	}
+
+	return touched;
+}
+
+auto update_entities(const GridMap& map, Entities& entities, double dt, ThreadPool* pool) -> void
+{
+	std::size_t count = {get_entity_count(entities)};
+	entities.next_x.resize(count);
+	entities.next_y.resize(count);
+	build_spatial_hash(entities.hash, entities.x, entities.y);
+
+	int blocks = {static_cast<int>((count + ENTITY_BLOCK - 1) / ENTITY_BLOCK)};
+	auto move_block = [&map, &entities, dt, count](int block) {
+		std::size_t first = {static_cast<std::size_t>(block) * ENTITY_BLOCK};
+		for (std::size_t i = first; i < std::min(first + ENTITY_BLOCK, count); i++)
+			move_entity(map, entities, i, dt, entities.next_x[i], entities.next_y[i]);
+	};
+	if (pool == nullptr || blocks < 2)
+		for (int block = 0; block < blocks; block++)
+			move_block(block);
+	else
+		pool->parallel_for(blocks, move_block);
+
+	entities.x.swap(entities.next_x);
+	entities.y.swap(entities.next_y);
+}
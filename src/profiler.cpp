@@ -0,0 +1,161 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include "profiler.hpp"
+
+std::atomic<bool> profiler_enabled = {false};
+
+namespace {
+
+	const char* PROFILE_STAGE_NAMES[PROFILE_STAGES] = {"frame", "input", "update", "ray walk", "wall draw",
+		"floor/ceiling", "sprites", "downsample", "console fill", "flush"};
+
+	struct ProfileEvent {
+		std::int64_t started;
+		std::int64_t ended;
+		std::int32_t stage;
+		std::int32_t thread;
+	};
+
+	// Totals since the profiler started and for the frame in progress (summed over every thread)
+	std::atomic<std::int64_t> totals[PROFILE_STAGES] = {};
+	std::atomic<std::int64_t> frame_totals[PROFILE_STAGES] = {};
+
+	// The last PROFILE_WINDOW frames' totals, as a ring, and their sums
+	std::int64_t history[PROFILE_WINDOW][PROFILE_STAGES] = {};
+	std::int64_t window_totals[PROFILE_STAGES] = {};
+	int history_at = {0};
+	int history_frames = {0};
+
+	// Trace
+	std::unique_ptr<ProfileEvent[]> trace = {};
+	std::size_t trace_capacity = {0};
+	std::atomic<std::size_t> trace_count = {0};
+	std::int64_t trace_origin = {0};
+
+	// Small numbers for threads, handed out the first time each one records anything
+	std::atomic<int> next_thread = {0};
+	thread_local int profile_thread = {-1};
+}
+
+auto get_profile_stage_name(ProfileStage stage) -> const char*
+{
+	return PROFILE_STAGE_NAMES[static_cast<int>(stage)];
+}
+
+auto start_profiler(std::size_t trace_events) -> void
+{
+	profiler_enabled.store(false, std::memory_order_relaxed);
+	for (int stage = 0; stage < PROFILE_STAGES; stage++) {
+		totals[stage] = 0;
+		frame_totals[stage] = 0;
+		window_totals[stage] = 0;
+		for (int frame = 0; frame < PROFILE_WINDOW; frame++)
+			history[frame][stage] = 0;
+	}
+	history_at = 0;
+	history_frames = 0;
+
+	if (trace_events > 0 && trace_events != trace_capacity) {
+		trace = std::make_unique<ProfileEvent[]>(trace_events);
+		trace_capacity = trace_events;
+	}
+	trace_count = 0;
+	trace_origin = get_nanoseconds();
+	profiler_enabled.store(true, std::memory_order_relaxed);
+}
+
+auto stop_profiler() -> void
+{
+	profiler_enabled.store(false, std::memory_order_relaxed);
+}
+
+auto record_profile(ProfileStage stage, std::int64_t started, std::int64_t ended) -> void
+{
+	int index = {static_cast<int>(stage)};
+	totals[index].fetch_add(ended - started, std::memory_order_relaxed);
+	frame_totals[index].fetch_add(ended - started, std::memory_order_relaxed);
+
+	// Events past the end of the trace are counted but not kept
+	if (trace_capacity > 0) {
+		if (profile_thread < 0)
+			profile_thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+		std::size_t event = {trace_count.fetch_add(1, std::memory_order_relaxed)};
+		if (event < trace_capacity)
+			trace[event] = {started, ended, index, profile_thread};
+	}
+}
+
+auto end_profile_frame() -> void
+{
+	if (!is_profiling())
+		return;
+
+	for (int stage = 0; stage < PROFILE_STAGES; stage++) {
+		std::int64_t frame = {frame_totals[stage].exchange(0, std::memory_order_relaxed)};
+		window_totals[stage] += frame - history[history_at][stage];
+		history[history_at][stage] = frame;
+	}
+	history_at = (history_at + 1) % PROFILE_WINDOW;
+	history_frames = std::min(history_frames + 1, PROFILE_WINDOW);
+}
+
+auto get_profile_total(ProfileStage stage) -> std::int64_t
+{
+	return totals[static_cast<int>(stage)].load(std::memory_order_relaxed);
+}
+
+auto get_profile_average(ProfileStage stage) -> double
+{
+	// ms per frame
+	if (history_frames == 0)
+		return 0;
+
+	return window_totals[static_cast<int>(stage)] / 1e6 / history_frames;
+}
+
+auto save_profile_trace(const char* file) -> bool
+{
+	// Chrome's trace event format (chrome://tracing or https://ui.perfetto.dev), one complete event per stage timed,
+	// in microseconds from when the profiler started
+	std::size_t count = {std::min(trace_count.load(std::memory_order_relaxed), trace_capacity)};
+	std::ofstream out(file);
+	out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	for (std::size_t event = 0; event < count; event++) {
+		const ProfileEvent& recorded = {trace[event]};
+		out << (event > 0 ? ",\n" : "\n") << "{\"name\": \"" << PROFILE_STAGE_NAMES[recorded.stage] <<
+			"\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << recorded.thread << ", \"ts\": " <<
+			(recorded.started - trace_origin) / 1e3 << ", \"dur\": " << (recorded.ended - recorded.started) / 1e3 <<
+			"}";
+	}
+	out << "\n]}\n";
+	if (!out) {
+		std::cout << "Trace " << file << " could not be written!" << std::endl;
+		return false;
+	}
+
+	std::cout << "Trace of " << count << " stages written to " << file;
+	if (trace_count > count)
+		std::cout << " (" << trace_count - count << " more did not fit)";
+	std::cout << std::endl;
+
+	return true;
+}
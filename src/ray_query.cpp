@@ -0,0 +1,93 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+
+#include "ray_query.hpp"
+
+namespace {
+
+	auto run_ray_block(const GridMap& map, const RayQueries& queries, RayResults& results, std::size_t first,
+		std::size_t last) -> void
+	{
+		// Each ray walks the grid on its own, as how far it gets before its next jump depends on where it is; what it
+		// found is then spread over the result arrays
+		for (std::size_t i = first; i < last; i++) {
+			RayHit hit = {cast_ray_limited(map, queries.origin_x[i], queries.origin_y[i], queries.dir_x[i],
+				queries.dir_y[i], queries.max_dist[i])};
+			results.wall[i] = hit.wall;
+			results.cell_x[i] = hit.cell_x;
+			results.cell_y[i] = hit.cell_y;
+			results.dist[i] = hit.dist;
+			results.hit_x[i] = hit.hit_x;
+			results.hit_y[i] = hit.hit_y;
+			results.txt_x[i] = hit.txt_x;
+			results.vertical[i] = hit.vertical;
+		}
+	}
+}
+
+auto clear_ray_queries(RayQueries& queries) -> void
+{
+	queries.origin_x.clear();
+	queries.origin_y.clear();
+	queries.dir_x.clear();
+	queries.dir_y.clear();
+	queries.max_dist.clear();
+}
+
+auto add_ray_query(RayQueries& queries, double origin_x, double origin_y, double dir_x, double dir_y) -> void
+{
+	queries.origin_x.push_back(origin_x);
+	queries.origin_y.push_back(origin_y);
+	queries.dir_x.push_back(dir_x);
+	queries.dir_y.push_back(dir_y);
+	queries.max_dist.push_back(HUGE_VAL);
+}
+
+auto add_sight_query(RayQueries& queries, double from_x, double from_y, double to_x, double to_y) -> void
+{
+	// Looking along the line between them, as far as the target and no further
+	queries.origin_x.push_back(from_x);
+	queries.origin_y.push_back(from_y);
+	queries.dir_x.push_back(to_x - from_x);
+	queries.dir_y.push_back(to_y - from_y);
+	queries.max_dist.push_back(1);
+}
+
+auto run_ray_queries(const GridMap& map, const RayQueries& queries, RayResults& results, ThreadPool* pool) -> void
+{
+	std::size_t count = {get_ray_query_count(queries)};
+	results.wall.resize(count);
+	results.cell_x.resize(count);
+	results.cell_y.resize(count);
+	results.dist.resize(count);
+	results.hit_x.resize(count);
+	results.hit_y.resize(count);
+	results.txt_x.resize(count);
+	results.vertical.resize(count);
+
+	int blocks = {static_cast<int>((count + RAY_QUERY_BLOCK - 1) / RAY_QUERY_BLOCK)};
+	auto run_block = [&map, &queries, &results, count](int block) {
+		std::size_t first = {static_cast<std::size_t>(block) * RAY_QUERY_BLOCK};
+		run_ray_block(map, queries, results, first, std::min(first + RAY_QUERY_BLOCK, count));
+	};
+	if (pool == nullptr || blocks < 2)
+		for (int block = 0; block < blocks; block++)
+			run_block(block);
+	else
+		pool->parallel_for(blocks, run_block);
+}
@@ -0,0 +1,390 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+
+#include "raycast.hpp"
+
+namespace {
+
+	template <typename T>
+	auto sign(T val) -> int
+	{
+		return (T(0) < val) - (val < T(0));
+	}
+
+	// Progress of a DDA along one axis. The distance (in multiples of the direction) to each grid line is worked out
+	// from the number of lines before it, not added up line by line, so that jumping over several lines arrives at
+	// exactly the distances stepping would have. A ray parallel to an axis never reaches the other axis' lines.
+	struct DdaAxis {
+		int step;							// -1, 0 or 1
+		int cell;							// Cell the ray is in along this axis
+		int crossed;						// Grid lines crossed so far
+		double first;						// Distance to the first grid line
+		double delta;						// and between grid lines
+	};
+
+	auto create_dda_axis(double origin, double dir) -> DdaAxis
+	{
+		DdaAxis axis = {sign(dir), static_cast<int>(std::floor(origin)), 0, HUGE_VAL, 0};
+		if (axis.step != 0) {
+			axis.delta = std::abs(1.0 / dir);
+			axis.first = (axis.step > 0 ? axis.cell + 1 - origin : origin - axis.cell) * axis.delta;
+		}
+
+		return axis;
+	}
+
+	inline auto get_side(const DdaAxis& axis, int line) -> double
+	{
+		return axis.first + line * axis.delta;
+	}
+
+	inline auto advance_dda(DdaAxis& axis, int crossed) -> void
+	{
+		axis.cell += axis.step * (crossed - axis.crossed);
+		axis.crossed = crossed;
+	}
+
+	// Cross whichever grid line is closer (ties go to the horizontal line, as in the walk)
+	inline auto step_dda(DdaAxis& x, DdaAxis& y, RayHit& hit) -> void
+	{
+		double side_x = {get_side(x, x.crossed)};
+		double side_y = {get_side(y, y.crossed)};
+		hit.vertical = side_x < side_y;
+		hit.dist = hit.vertical ? side_x : side_y;
+		advance_dda(hit.vertical ? x : y, (hit.vertical ? x.crossed : y.crossed) + 1);
+	}
+
+	// The first of an axis' lines, from those not yet crossed up to limit, that stepping would not cross before
+	// reaching dist (one at exactly dist is crossed first if inclusive). Estimated, then corrected for rounding.
+	auto find_dda_line(const DdaAxis& axis, double dist, bool inclusive, int limit) -> int
+	{
+		if (axis.step == 0)
+			return axis.crossed;
+
+		auto is_before = [&axis, dist, inclusive](int line) {
+			double side = {get_side(axis, line)};
+			return inclusive ? side <= dist : side < dist;
+		};
+		double estimate = {std::clamp((dist - axis.first) / axis.delta, 1.0 * axis.crossed, 1.0 * limit)};
+		int line = {static_cast<int>(estimate)};
+		while (line > axis.crossed && !is_before(line - 1))
+			line--;
+		while (line < limit && is_before(line))
+			line++;
+
+		return line;
+	}
+
+	// Every cell less than reach + 1 cells away is empty, so cross every line up to (but not including) the first
+	// that would take the ray further than that, in the order stepping would
+	auto jump_dda(DdaAxis& x, DdaAxis& y, int reach) -> void
+	{
+		int last_x = {x.crossed + reach};
+		int last_y = {y.crossed + reach};
+		double leave_x = {x.step != 0 ? get_side(x, last_x) : HUGE_VAL};
+		double leave_y = {y.step != 0 ? get_side(y, last_y) : HUGE_VAL};
+		if (leave_x < leave_y) {
+			advance_dda(y, find_dda_line(y, leave_x, true, last_y));
+			advance_dda(x, last_x);
+		} else {
+			advance_dda(x, find_dda_line(x, leave_y, false, last_x));
+			advance_dda(y, last_y);
+		}
+	}
+
+	// Where a ray meets the grid line it crossed last (hit_x for a vertical line, or hit_y), and which texture column
+	// that is, mirrored so that textures read left to right from whichever side they're seen
+	auto finish_hit(double origin_x, double origin_y, double dir_x, double dir_y, RayHit& hit) -> void
+	{
+		if (hit.vertical) {
+			hit.hit_y = origin_y + (hit.hit_x - origin_x) * (dir_y / dir_x);
+			hit.txt_x = RAY_TEXTURE_SIZE * (hit.hit_y - std::floor(hit.hit_y));
+			if (dir_x > 0)
+				hit.txt_x = RAY_TEXTURE_SIZE - 1 - hit.txt_x;
+		} else {
+			hit.hit_x = origin_x + (hit.hit_y - origin_y) * (dir_x / dir_y);
+			hit.txt_x = RAY_TEXTURE_SIZE * (hit.hit_x - std::floor(hit.hit_x));
+			if (dir_y < 0)
+				hit.txt_x = RAY_TEXTURE_SIZE - 1 - hit.txt_x;
+		}
+	}
+
+	auto finish_dda(const DdaAxis& x, const DdaAxis& y, double origin_x, double origin_y, double dir_x, double dir_y,
+		RayHit& hit) -> void
+	{
+		hit.cell_x = x.cell;
+		hit.cell_y = y.cell;
+		if (hit.vertical)
+			hit.hit_x = x.step > 0 ? x.cell : x.cell + 1;
+		else
+			hit.hit_y = y.step > 0 ? y.cell : y.cell + 1;
+		finish_hit(origin_x, origin_y, dir_x, dir_y, hit);
+	}
+
+	// A ray through the exact corner of a cell could equally be said to hit either face (or to slip between two
+	// diagonal blocks), and which one each traversal picks is down to rounding
+	auto is_corner(const RayHit& hit) -> bool
+	{
+		return std::abs(hit.hit_x - std::round(hit.hit_x)) < 1e-9 && std::abs(hit.hit_y - std::round(hit.hit_y)) < 1e-9;
+	}
+}
+
+auto get_traversal_name(Traversal traversal) -> const char*
+{
+	if (traversal == Traversal::skipping)
+		return "skipping";
+	else
+		return traversal == Traversal::dda ? "dda" : "legacy";
+}
+
+auto cast_ray(Traversal traversal, const GridMap& map, double origin_x, double origin_y, double dir_x,
+	double dir_y) -> RayHit
+{
+	if (traversal == Traversal::skipping)
+		return cast_ray_skipping(map, origin_x, origin_y, dir_x, dir_y);
+	else if (traversal == Traversal::dda)
+		return cast_ray_dda(map, origin_x, origin_y, dir_x, dir_y);
+	else
+		return cast_ray_legacy(map, origin_x, origin_y, dir_x, dir_y);
+}
+
+auto cast_ray_legacy(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit
+{
+	// Step sizes
+	int step_x = {sign(dir_x)};
+	int step_y = {sign(dir_y)};
+
+	// Calculate Grid lines and hitpoints
+	int l_vx = {static_cast<int>(std::round(origin_x + 0.5 * step_x))};
+	double l_vy = {-1};
+	int l_hy = {static_cast<int>(std::round(origin_y + 0.5 * step_y))};
+	double l_hx = {-1};
+
+	// Find where ray hits
+	RayHit hit = {0, -1, -1, -1, 0, 0, -1, false};
+	while (hit.dist < 0) {
+
+		// Calculate the hitpoints using the Grid lines
+		if (l_vy == -1 && step_x != 0)
+			l_vy = origin_y + (l_vx - origin_x) * (dir_y / dir_x);
+
+		if (l_hx == -1 && step_y != 0)
+			l_hx = origin_x + (l_hy - origin_y) * (dir_x / dir_y);
+
+		// Determine which one "wins" (i,e. the shortest distance/closest one)
+		if (l_vy != -1 && l_hx != -1)
+			hit.vertical = step_x * (l_vx - origin_x) < step_x * (l_hx - origin_x);
+		else
+			hit.vertical = l_vy != -1;
+
+		// Determine array indices
+		if (hit.vertical) {
+			hit.hit_x = l_vx;
+			hit.hit_y = l_vy;
+			hit.txt_x = RAY_TEXTURE_SIZE * (hit.hit_y - std::floor(hit.hit_y));
+
+			// If looking from the left, mirror the texture to correct
+			if (step_x == 1)
+				hit.txt_x = RAY_TEXTURE_SIZE - 1 - hit.txt_x;
+
+			l_vx += step_x;
+			l_vy = -1;
+			hit.cell_x = static_cast<int>(step_x < 0 ? hit.hit_x - 1 : hit.hit_x);
+			hit.cell_y = static_cast<int>(std::ceil(hit.hit_y)) - 1;
+		} else {
+			hit.hit_x = l_hx;
+			hit.hit_y = l_hy;
+			hit.txt_x = RAY_TEXTURE_SIZE * (hit.hit_x - std::floor(hit.hit_x));
+
+			// If looking from above, mirror the texture to correct
+			if (step_y == -1)
+				hit.txt_x = RAY_TEXTURE_SIZE - 1 - hit.txt_x;
+
+			l_hx = -1;
+			l_hy += step_y;
+			hit.cell_x = static_cast<int>(std::floor(hit.hit_x));
+			hit.cell_y = static_cast<int>(step_y < 0 ? hit.hit_y - 1 : hit.hit_y);
+		}
+
+		// If we've hit a block
+		hit.wall = get_grid_cell(map, hit.cell_x, hit.cell_y);
+		if (hit.wall != 0) {
+			double dx = {hit.hit_x - origin_x};
+			double dy = {hit.hit_y - origin_y};
+			hit.dist = std::sqrt((dx * dx + dy * dy) / (dir_x * dir_x + dir_y * dir_y));
+		}
+	}
+
+	return hit;
+}
+
+auto cast_ray_dda(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit
+{
+	// Step to whichever grid line is closer until a wall is found
+	DdaAxis x = {create_dda_axis(origin_x, dir_x)};
+	DdaAxis y = {create_dda_axis(origin_y, dir_y)};
+	RayHit hit = {0, -1, -1, 0, 0, 0, 0, false};
+	while (hit.wall == 0) {
+		step_dda(x, y, hit);
+		hit.wall = get_grid_cell(map, x.cell, y.cell);
+	}
+	finish_dda(x, y, origin_x, origin_y, dir_x, dir_y, hit);
+
+	return hit;
+}
+
+auto cast_ray_skipping(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y) -> RayHit
+{
+	return cast_ray_limited(map, origin_x, origin_y, dir_x, dir_y, HUGE_VAL);
+}
+
+auto cast_ray_limited(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y,
+	double max_dist) -> RayHit
+{
+	// A ray with no direction never gets anywhere (and would never cross a grid line), so it ends where it started
+	if (dir_x == 0 && dir_y == 0) {
+		int cell_x = {static_cast<int>(std::floor(origin_x))};
+		int cell_y = {static_cast<int>(std::floor(origin_y))};
+		return {get_grid_cell(map, cell_x, cell_y), cell_x, cell_y, 0, origin_x, origin_y, 0, false};
+	}
+
+	// As the DDA, but wherever the clearance says the cells around are empty, jump straight to the last grid line
+	// before the ray leaves them. Only clearance is read on the way, as it is 0 in (and only in) walls.
+	DdaAxis x = {create_dda_axis(origin_x, dir_x)};
+	DdaAxis y = {create_dda_axis(origin_y, dir_y)};
+	RayHit hit = {0, -1, -1, 0, 0, 0, 0, false};
+	int clearance = {std::max(get_grid_clearance(map, x.cell, y.cell), 1)};
+	while (clearance != 0) {
+		if (clearance > 1)
+			jump_dda(x, y, clearance - 1);
+		step_dda(x, y, hit);
+
+		// A jump only ever crosses empty cells, so the ray can't have reached a wall before max_dist without this
+		// step taking it there
+		if (hit.dist >= max_dist) {
+			double end_x = {origin_x + dir_x * max_dist};
+			double end_y = {origin_y + dir_y * max_dist};
+			return {0, static_cast<int>(std::floor(end_x)), static_cast<int>(std::floor(end_y)), max_dist, end_x, end_y,
+				0, false};
+		}
+		clearance = get_grid_clearance(map, x.cell, y.cell);
+	}
+	hit.wall = get_grid_cell(map, x.cell, y.cell);
+	finish_dda(x, y, origin_x, origin_y, dir_x, dir_y, hit);
+
+	return hit;
+}
+
+auto cast_ray_layers(const GridMap& map, double origin_x, double origin_y, double dir_x, double dir_y,
+	RayLayer* layers, int max_layers, int& count) -> RayHit
+{
+	// As skipping, but a wall with a gap is noted along with where the ray leaves its cell (the next grid line), and
+	// the ray steps on out of it
+	DdaAxis x = {create_dda_axis(origin_x, dir_x)};
+	DdaAxis y = {create_dda_axis(origin_y, dir_y)};
+	RayHit hit = {0, -1, -1, 0, 0, 0, 0, false};
+	int clearance = {std::max(get_grid_clearance(map, x.cell, y.cell), 1)};
+	count = 0;
+	while (true) {
+		if (clearance > 1)
+			jump_dda(x, y, clearance - 1);
+		step_dda(x, y, hit);
+		clearance = get_grid_clearance(map, x.cell, y.cell);
+		if (clearance != 0)
+			continue;
+
+		hit.wall = get_grid_cell(map, x.cell, y.cell);
+		finish_dda(x, y, origin_x, origin_y, dir_x, dir_y, hit);
+		if (is_grid_full_height(map, x.cell, y.cell))
+			return hit;
+		if (count < max_layers)
+			layers[count++] = {hit, std::min(get_side(x, x.crossed), get_side(y, y.crossed))};
+		clearance = 1;
+	}
+}
+
+auto interpolate_ray(const RayHit& before, const RayHit& after, double spread, double origin_x, double origin_y,
+	double dir_x, double dir_y, RayHit& hit) -> bool
+{
+	// Both rays have to end on the same face of the same wall, and be close enough together all the way there that no
+	// block could sit between them without either one hitting it (a block is at least a square wide however it's
+	// looked at)
+	if (before.wall == 0 || before.cell_x != after.cell_x || before.cell_y != after.cell_y ||
+		before.vertical != after.vertical)
+		return false;
+	double reach = {std::max(std::hypot(before.hit_x - origin_x, before.hit_y - origin_y),
+		std::hypot(after.hit_x - origin_x, after.hit_y - origin_y))};
+	if (reach * spread >= RAY_REUSE_GAP)
+		return false;
+
+	// Then a ray between them ends on that face as well
+	hit = before;
+	finish_hit(origin_x, origin_y, dir_x, dir_y, hit);
+	hit.dist = hit.vertical ? (hit.hit_x - origin_x) / dir_x : (hit.hit_y - origin_y) / dir_y;
+
+	return true;
+}
+
+auto check_traversal(const GridMap& map, int* rays, int* corners) -> int
+{
+	// Sweep a 3x3 spread of positions inside every empty cell through a full turn, counting rays where the legacy
+	// walk and the DDA disagree on the cell, the face or the texture column that was hit. Rays through a cell corner
+	// are counted separately as either answer is right. Skipping must give exactly what the DDA does, corner or not.
+	const int angles = {720};
+	int mismatches = {0};
+	int count = {0};
+	int corner_count = {0};
+	for (int cell_y = 0; cell_y < map.height; cell_y++) {
+		for (int cell_x = 0; cell_x < map.width; cell_x++) {
+			if (get_grid_cell(map, cell_x, cell_y) != 0)
+				continue;
+			for (int k = 0; k < 9; k++) {
+				double origin_x = {cell_x + 0.25 + 0.25 * (k % 3)};
+				double origin_y = {cell_y + 0.25 + 0.25 * (k / 3)};
+				for (int a = 0; a < angles; a++) {
+					double angle = {2 * M_PI * (a + 0.5 * k / 9.0) / angles};
+					double dir_x = {std::cos(angle)};
+					double dir_y = {std::sin(angle)};
+					RayHit legacy = {cast_ray_legacy(map, origin_x, origin_y, dir_x, dir_y)};
+					RayHit dda = {cast_ray_dda(map, origin_x, origin_y, dir_x, dir_y)};
+					RayHit skipping = {cast_ray_skipping(map, origin_x, origin_y, dir_x, dir_y)};
+					count++;
+					if (skipping.wall != dda.wall || skipping.cell_x != dda.cell_x || skipping.cell_y != dda.cell_y ||
+						skipping.dist != dda.dist || skipping.hit_x != dda.hit_x || skipping.hit_y != dda.hit_y ||
+						skipping.txt_x != dda.txt_x || skipping.vertical != dda.vertical) {
+						mismatches++;
+						continue;
+					}
+					if (legacy.cell_x == dda.cell_x && legacy.cell_y == dda.cell_y && legacy.txt_x == dda.txt_x &&
+						legacy.vertical == dda.vertical && std::abs(legacy.dist - dda.dist) <= 1e-9)
+						continue;
+					if (is_corner(legacy) || is_corner(dda))
+						corner_count++;
+					else
+						mismatches++;
+				}
+			}
+		}
+	}
+	if (rays != nullptr)
+		*rays = count;
+	if (corners != nullptr)
+		*corners = corner_count;
+
+	return mismatches;
+}
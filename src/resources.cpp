@@ -0,0 +1,125 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <SDL2/SDL_image.h>
+
+#include "resources.hpp"
+
+namespace {
+
+	// Blocks are big enough for the whole wall sheet, so that a typical set of textures fits in one
+	const std::size_t ARENA_BLOCK_PIXELS = {1 << 20};
+
+	auto decode_image(const std::string& file, Uint32 format) -> SurfaceHandle
+	{
+		RWopsHandle io(SDL_RWFromFile(file.c_str(), "rb"));
+		if (io == nullptr) {
+			std::cout << "SDL_RWFromFile: " << SDL_GetError() << std::endl;
+			return nullptr;
+		}
+		SurfaceHandle loaded(IMG_LoadPNG_RW(io.get()));
+		if (loaded == nullptr) {
+			std::cout << "IMG_LoadPNG_RW: " << IMG_GetError() << std::endl;
+			return nullptr;
+		}
+
+		// Everything is drawn from 32 bit pixels so convert on load rather than per texel
+		SurfaceHandle converted(SDL_ConvertSurfaceFormat(loaded.get(), format, 0));
+		if (converted == nullptr)
+			std::cout << "SDL_ConvertSurfaceFormat: " << SDL_GetError() << std::endl;
+
+		return converted;
+	}
+}
+
+auto ResourceCache::load_image(const std::string& file, Uint32 format) -> std::shared_ptr<const Image>
+{
+	return load_images({file}, format, nullptr).front();
+}
+
+auto ResourceCache::load_images(const std::vector<std::string>& files, Uint32 format, ThreadPool* pool) ->
+	std::vector<std::shared_ptr<const Image>>
+{
+	// Decoding is the slow part and each file is independent, so only that happens on the pool; nothing is added to
+	// the cache until every thread is done with it
+	std::vector<SurfaceHandle> decoded(files.size());
+	auto decode = [this, &files, &decoded, format](int index) {
+		if (images.find({files[index], format}) == images.end())
+			decoded[index] = decode_image(files[index], format);
+	};
+	if (pool != nullptr)
+		pool->parallel_for(static_cast<int>(files.size()), decode);
+	else
+		for (int index = 0; index < static_cast<int>(files.size()); index++)
+			decode(index);
+
+	std::vector<std::shared_ptr<const Image>> loaded(files.size());
+	for (std::size_t index = 0; index < files.size(); index++) {
+		auto found = images.find({files[index], format});
+		if (found != images.end())
+			loaded[index] = found->second;
+		else if (decoded[index] != nullptr)
+			loaded[index] = store_image(files[index], format, decoded[index].get());
+	}
+
+	return loaded;
+}
+
+auto ResourceCache::get_image_count() const -> std::size_t
+{
+	return images.size();
+}
+
+auto ResourceCache::get_arena_size() const -> std::size_t
+{
+	return arena_size;
+}
+
+auto ResourceCache::store_image(const std::string& file, Uint32 format, SDL_Surface* surface) ->
+	std::shared_ptr<const Image>
+{
+	const int width = {surface->w};
+	const int height = {surface->h};
+	std::uint32_t* pixels = {allocate(static_cast<std::size_t>(width) * height)};
+	for (int y = 0; y < height; y++)
+		std::memcpy(pixels + static_cast<std::size_t>(y) * width,
+			static_cast<const std::uint8_t*>(surface->pixels) + static_cast<std::size_t>(y) * surface->pitch,
+			width * sizeof(std::uint32_t));
+
+	std::shared_ptr<const Image> image = {std::make_shared<const Image>(Image{pixels, width, height, blocks.back()})};
+	images[{file, format}] = image;
+
+	return image;
+}
+
+auto ResourceCache::allocate(std::size_t pixels) -> std::uint32_t*
+{
+	// A new block when the newest one is full, bigger than usual if need be; what's left of the old one is wasted
+	if (blocks.empty() || block_used + pixels > block_size) {
+		block_size = std::max(pixels, ARENA_BLOCK_PIXELS);
+		block_used = 0;
+		blocks.push_back(std::shared_ptr<std::uint32_t[]>(new std::uint32_t[block_size]));
+		arena_size += block_size;
+	}
+
+	std::uint32_t* start = {blocks.back().get() + block_used};
+	block_used += pixels;
+
+	return start;
+}
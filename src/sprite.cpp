@@ -0,0 +1,114 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#include "sprite.hpp"
+
+auto load_sprites(const char* file, int textures) -> std::vector<Sprite>
+{
+	// One sprite per line as "x y texture"
+	std::ifstream in(file);
+	if (!in) {
+		std::cout << "Sprites " << file << " could not be loaded! The file could not be opened" << std::endl;
+		return {};
+	}
+
+	std::vector<Sprite> sprites = {};
+	Sprite sprite = {};
+	while (in >> sprite.x >> sprite.y >> sprite.texture) {
+		if (sprite.texture < 0 || sprite.texture >= textures) {
+			std::cout << "Sprites " << file << " could not be loaded! No texture " << sprite.texture <<
+				" for sprite " << sprites.size() + 1 << std::endl;
+			return {};
+		}
+		sprites.push_back(sprite);
+	}
+
+	return sprites;
+}
+
+auto scatter_sprites(const GridMap& map, int count, int textures, unsigned int seed) -> std::vector<Sprite>
+{
+	// Somewhere in an empty cell, away from its walls, so the same seed always gives the same sprites
+	std::vector<std::pair<int, int>> empty = {};
+	for (int y = 0; y < map.height; y++)
+		for (int x = 0; x < map.width; x++)
+			if (get_grid_cell(map, x, y) == 0)
+				empty.push_back({x, y});
+	if (empty.empty() || textures <= 0)
+		return {};
+
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<std::size_t> cell(0, empty.size() - 1);
+	std::uniform_real_distribution<double> offset(0.2, 0.8);
+	std::uniform_int_distribution<int> texture(0, textures - 1);
+	std::vector<Sprite> sprites(count);
+	for (Sprite& sprite : sprites) {
+		const std::pair<int, int>& at = {empty[cell(random)]};
+		sprite.x = at.first + offset(random);
+		sprite.y = at.second + offset(random);
+		sprite.texture = texture(random);
+	}
+
+	return sprites;
+}
+
+auto project_sprites(const std::vector<Sprite>& sprites, const VisibilitySet& visibility, double origin_x,
+	double origin_y, double view_cos, double view_sin, double tan_half_fov, int surface_width,
+	std::vector<SpriteView>& views) -> void
+{
+	// Column i's ray goes through the camera plane at tan_half_fov - 2 * tan_half_fov * (i + 1) / surface_width, so
+	// a sprite's centre lands on the column whose ray points at it, and a square across covers as many columns as a
+	// square of wall at the same distance
+	const double columns_per_tangent = {surface_width / (2 * tan_half_fov)};
+	const int cell_x = {static_cast<int>(std::floor(origin_x))};
+	const int cell_y = {static_cast<int>(std::floor(origin_y))};
+	views.clear();
+	views.reserve(sprites.size());
+	for (const Sprite& sprite : sprites) {
+		double dx = {sprite.x - origin_x};
+		double dy = {sprite.y - origin_y};
+		double depth = {dx * view_cos + dy * view_sin};
+		if (depth < SPRITE_NEAR_DIST)
+			continue;
+
+		// Nor is anything that can't be seen from anywhere in the camera's cell: further away in its direction than
+		// any ray from the cell gets (less half a square, as far as a sprite reaches from its centre), or in a cell
+		// that's out of sight
+		if (std::hypot(dx, dy) - M_SQRT1_2 > get_visibility_reach(visibility, cell_x, cell_y, std::atan2(dy, dx)) ||
+			!is_cell_visible(visibility, cell_x, cell_y, static_cast<int>(std::floor(sprite.x)),
+			static_cast<int>(std::floor(sprite.y))))
+			continue;
+
+		// Anything wholly off either side of the screen is dropped here, before sorting
+		double across = {(dy * view_cos - dx * view_sin) / depth};
+		double width = {columns_per_tangent / depth};
+		double left = {(tan_half_fov - across) * columns_per_tangent - 1 - width / 2};
+		int first = {std::max(static_cast<int>(std::ceil(left)), 0)};
+		int last = {std::min(static_cast<int>(std::ceil(left + width)), surface_width)};
+		if (first < last)
+			views.push_back({depth, left, width, first, last, sprite.texture});
+	}
+
+	// Furthest first, so that nearer sprites are drawn over them
+	std::sort(views.begin(), views.end(), [](const SpriteView& a, const SpriteView& b) {
+		return a.depth > b.depth;
+	});
+}
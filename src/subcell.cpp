@@ -0,0 +1,94 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "subcell.hpp"
+
+namespace {
+
+	// Shape drawing exactly the pixels in a mask (1 top left, 2 top right, 4 bottom left, 8 bottom right) in the
+	// foreground, or failing that exactly the others, as only half of the 16 masks have a character of their own
+	struct MaskShape {
+		SubcellShape shape;
+		bool inverted;						// The shape draws the pixels outside the mask
+	};
+	const MaskShape MASK_SHAPES[16] = {
+		{SubcellShape::blank, false}, {SubcellShape::nw, false}, {SubcellShape::ne, false},
+		{SubcellShape::n, false}, {SubcellShape::sw, false}, {SubcellShape::e, true}, {SubcellShape::diag, true},
+		{SubcellShape::se, true}, {SubcellShape::se, false}, {SubcellShape::diag, false}, {SubcellShape::e, false},
+		{SubcellShape::sw, true}, {SubcellShape::n, true}, {SubcellShape::ne, true}, {SubcellShape::nw, true},
+		{SubcellShape::blank, true}
+	};
+
+	auto get_distance(std::uint32_t first, std::uint32_t second) -> int
+	{
+		int r = {static_cast<int>((first >> 16) & 0xFF) - static_cast<int>((second >> 16) & 0xFF)};
+		int g = {static_cast<int>((first >> 8) & 0xFF) - static_cast<int>((second >> 8) & 0xFF)};
+		int b = {static_cast<int>(first & 0xFF) - static_cast<int>(second & 0xFF)};
+
+		return r * r + g * g + b * b;
+	}
+
+	// Average colour of the pixels in (or not in) a mask
+	auto get_average(const std::uint32_t* pixels, int mask, bool in_mask) -> std::uint32_t
+	{
+		std::uint32_t r = {0};
+		std::uint32_t g = {0};
+		std::uint32_t b = {0};
+		std::uint32_t count = {0};
+		for (int i = 0; i < 4; i++) {
+			if (((mask >> i) & 1) == (in_mask ? 1 : 0)) {
+				r += (pixels[i] >> 16) & 0xFF;
+				g += (pixels[i] >> 8) & 0xFF;
+				b += pixels[i] & 0xFF;
+				count++;
+			}
+		}
+
+		return count == 0 ? 0 : ((r / count) << 16) | ((g / count) << 8) | (b / count);
+	}
+}
+
+auto get_subcell_glyph(const std::uint32_t* top, const std::uint32_t* bottom) -> SubcellGlyph
+{
+	const std::uint32_t pixels[4] = {top[0], top[1], bottom[0], bottom[1]};
+
+	// The two pixels furthest apart in colour are the two colours the cell is split between
+	int first = {0};
+	int second = {0};
+	int widest = {0};
+	for (int i = 0; i < 4; i++)
+		for (int j = i + 1; j < 4; j++) {
+			int distance = {get_distance(pixels[i], pixels[j])};
+			if (distance > widest) {
+				widest = distance;
+				first = i;
+				second = j;
+			}
+		}
+	if (widest == 0)
+		return {SubcellShape::blank, pixels[0], pixels[0]};
+
+	// Every pixel goes with whichever of the two it's closer to, and each side is shown as its average
+	int mask = {0};
+	for (int i = 0; i < 4; i++)
+		if (get_distance(pixels[i], pixels[second]) < get_distance(pixels[i], pixels[first]))
+			mask |= 1 << i;
+	std::uint32_t in_mask = {get_average(pixels, mask, true)};
+	std::uint32_t out_of_mask = {get_average(pixels, mask, false)};
+
+	const MaskShape& entry = {MASK_SHAPES[mask]};
+	return entry.inverted ? SubcellGlyph{entry.shape, out_of_mask, in_mask} :
+		SubcellGlyph{entry.shape, in_mask, out_of_mask};
+}
@@ -0,0 +1,67 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "texture_atlas.hpp"
+
+auto create_texture_atlas(int tile_size) -> TextureAtlas
+{
+	TextureAtlas atlas = {{}, {}, tile_size, 1, nullptr};
+	while ((tile_size >> atlas.levels) > 0)
+		atlas.levels++;
+
+	return atlas;
+}
+
+auto add_atlas_texture(TextureAtlas& atlas, const std::uint32_t* pixels, int pitch) -> int
+{
+	int texture = {get_atlas_count(atlas)};
+
+	// Level 0 is the source transposed
+	int size = {atlas.tile_size};
+	std::size_t offset = {atlas.texels.size()};
+	atlas.offsets.push_back(offset);
+	atlas.texels.resize(offset + size * size);
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++)
+			atlas.texels[offset + x * size + y] = pixels[y * pitch + x];
+
+	// Every other level averages 2x2 texels of the one before, alpha included (sprites use it, walls ignore it)
+	for (int level = 1; level < atlas.levels; level++) {
+		std::size_t source = {offset};
+		int source_size = {size};
+		size /= 2;
+		offset = atlas.texels.size();
+		atlas.offsets.push_back(offset);
+		atlas.texels.resize(offset + size * size);
+		for (int x = 0; x < size; x++) {
+			for (int y = 0; y < size; y++) {
+				std::uint32_t r = {0};
+				std::uint32_t g = {0};
+				std::uint32_t b = {0};
+				std::uint32_t a = {0};
+				for (int k = 0; k < 4; k++) {
+					std::uint32_t texel = {atlas.texels[source + (2 * x + k / 2) * source_size + 2 * y + k % 2]};
+					r += (texel >> 16) & 0xFF;
+					g += (texel >> 8) & 0xFF;
+					b += texel & 0xFF;
+					a += texel >> 24;
+				}
+				atlas.texels[offset + x * size + y] = ((a / 4) << 24) | ((r / 4) << 16) | ((g / 4) << 8) | (b / 4);
+			}
+		}
+	}
+
+	return texture;
+}
@@ -0,0 +1,157 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "thread_pool.hpp"
+
+namespace {
+
+	auto pack(std::uint32_t begin, std::uint32_t end) -> std::uint64_t
+	{
+		return (static_cast<std::uint64_t>(end) << 32) | begin;
+	}
+
+	auto begin_of(std::uint64_t range) -> std::uint32_t
+	{
+		return static_cast<std::uint32_t>(range);
+	}
+
+	auto end_of(std::uint64_t range) -> std::uint32_t
+	{
+		return static_cast<std::uint32_t>(range >> 32);
+	}
+}
+
+ThreadPool::ThreadPool(unsigned int threads) : slices{}, size{threads < 1 ? 1 : threads}, generation{0},
+	stopping{false}, draining{0}, remaining{0}, task{nullptr}, context{nullptr}
+{
+	// Slice 0 belongs to whichever thread calls run()
+	slices = std::make_unique<Slice[]>(size);
+	for (unsigned int i = 0; i < size; i++)
+		slices[i].range.store(0);
+	for (unsigned int i = 1; i < size; i++)
+		workers.emplace_back(&ThreadPool::work_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+auto ThreadPool::get_size() const -> unsigned int
+{
+	return size;
+}
+
+auto ThreadPool::run(int count, void (*task_to_run)(void*, int), void* task_context) -> void
+{
+	if (count <= 0)
+		return;
+
+	task = task_to_run;
+	context = task_context;
+	remaining.store(count);
+	for (unsigned int i = 0; i < size; i++) {
+		std::uint32_t begin = {static_cast<std::uint32_t>(static_cast<std::uint64_t>(count) * i / size)};
+		std::uint32_t end = {static_cast<std::uint32_t>(static_cast<std::uint64_t>(count) * (i + 1) / size)};
+		slices[i].range.store(pack(begin, end), std::memory_order_release);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+		draining = size - 1;
+	}
+	wake.notify_all();
+
+	drain(0);
+
+	// The items can all be done while a worker is still on its way out of drain() (about to steal, say), so this
+	// call isn't over until every worker is out, or the next call's slices could be written over
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return remaining.load(std::memory_order_acquire) == 0 && draining == 0; });
+}
+
+auto ThreadPool::work_loop(unsigned int index) -> void
+{
+	std::uint64_t seen = {0};
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+		drain(index);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--draining == 0)
+				done.notify_all();
+		}
+	}
+}
+
+auto ThreadPool::drain(unsigned int index) -> void
+{
+	int item = {0};
+	while (pop(index, item) || (steal(index) && pop(index, item))) {
+		task(context, item);
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard<std::mutex> lock(mutex);
+			done.notify_all();
+		}
+	}
+}
+
+auto ThreadPool::pop(unsigned int index, int& item) -> bool
+{
+	std::atomic<std::uint64_t>& range = {slices[index].range};
+	std::uint64_t current = {range.load(std::memory_order_acquire)};
+	while (begin_of(current) < end_of(current)) {
+		if (range.compare_exchange_weak(current, pack(begin_of(current) + 1, end_of(current)),
+			std::memory_order_acq_rel)) {
+			item = static_cast<int>(begin_of(current));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+auto ThreadPool::steal(unsigned int index) -> bool
+{
+	// Only called once our own slice is empty, and thieves pass over empty slices, so within a call nothing else
+	// writes to it until the stolen half is stored there
+	for (unsigned int offset = 1; offset < size; offset++) {
+		std::atomic<std::uint64_t>& victim = {slices[(index + offset) % size].range};
+		std::uint64_t current = {victim.load(std::memory_order_acquire)};
+		while (begin_of(current) < end_of(current)) {
+			std::uint32_t begin = {begin_of(current)};
+			std::uint32_t end = {end_of(current)};
+			std::uint32_t middle = {begin + (end - begin) / 2};
+			if (victim.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel)) {
+				slices[index].range.store(pack(middle, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,276 @@
+// Copyright 2019 Dave Moore
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+// Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "visibility.hpp"
+
+namespace {
+
+	const char VISIBILITY_MAGIC[8] = {'R', 'A', 'Y', 'V', 'I', 'S', 'I', 'B'};
+
+	struct VisibilityHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t sectors;
+		std::uint64_t key;
+		std::int32_t width;
+		std::int32_t height;
+		std::uint64_t word_count;
+	};
+
+	// What the rays from one cell found, before it's packed in with every other cell's
+	struct CellVisibility {
+		VisibleBox box;
+		std::vector<std::uint64_t> words;
+		std::uint8_t reach[VISIBILITY_SECTORS];
+	};
+
+	// A mark for every cell of the map, and which ones are marked so they can be cleared again
+	struct VisibilityMarks {
+		std::vector<std::uint8_t> seen;
+		std::vector<int> marked;
+	};
+
+	// Each thread's marks, kept from one set to the next. Every cell's marks are cleared once it's done with them, so
+	// they only need clearing again when the size of the map changes.
+	thread_local VisibilityMarks thread_marks = {};
+
+	auto mark_cell(const GridMap& map, int x, int y, VisibilityMarks& marks) -> void
+	{
+		if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(map.width) ||
+			static_cast<unsigned int>(y) >= static_cast<unsigned int>(map.height))
+			return;
+		int index = {y * map.width + x};
+		if (marks.seen[index] == 0) {
+			marks.seen[index] = 1;
+			marks.marked.push_back(index);
+		}
+	}
+
+	// Marks every cell a ray enters up to and including the wall it stops at, and returns how far it got (in
+	// multiples of the direction). Walls are all that matter here, so a plain DDA does. A wall with a gap in it can
+	// be seen through, so the ray goes on.
+	auto walk_ray(const GridMap& map, double x, double y, double dir_x, double dir_y, VisibilityMarks& marks) -> double
+	{
+		int cell_x = {static_cast<int>(std::floor(x))};
+		int cell_y = {static_cast<int>(std::floor(y))};
+		int step_x = {dir_x > 0 ? 1 : -1};
+		int step_y = {dir_y > 0 ? 1 : -1};
+		double delta_x = {dir_x != 0 ? std::abs(1 / dir_x) : HUGE_VAL};
+		double delta_y = {dir_y != 0 ? std::abs(1 / dir_y) : HUGE_VAL};
+		double side_x = {(dir_x > 0 ? cell_x + 1 - x : x - cell_x) * delta_x};
+		double side_y = {(dir_y > 0 ? cell_y + 1 - y : y - cell_y) * delta_y};
+		double dist = {0};
+		while (true) {
+			mark_cell(map, cell_x, cell_y, marks);
+			if (get_grid_cell(map, cell_x, cell_y) != 0 && is_grid_full_height(map, cell_x, cell_y))
+				return dist;
+			if (side_x < side_y) {
+				dist = side_x;
+				side_x += delta_x;
+				cell_x += step_x;
+			} else {
+				dist = side_y;
+				side_y += delta_y;
+				cell_y += step_y;
+			}
+		}
+	}
+
+	auto build_cell(const GridMap& map, int cell_x, int cell_y, VisibilityMarks& marks) -> CellVisibility
+	{
+		CellVisibility cell = {{0, 0, 0, 0}, {}, {}};
+		std::fill(std::begin(cell.reach), std::end(cell.reach), VISIBILITY_UNBOUNDED);
+		if (get_grid_cell(map, cell_x, cell_y) != 0)
+			return cell;
+
+		// Every origin's rays are turned a little from the last one's, so between them they cover every direction
+		// sixteen times as finely
+		const int origins = {VISIBILITY_ORIGINS * VISIBILITY_ORIGINS};
+		double sector_reach[VISIBILITY_SECTORS] = {};
+		for (int origin = 0; origin < origins; origin++) {
+			double x = {cell_x + (origin % VISIBILITY_ORIGINS + 0.5) / VISIBILITY_ORIGINS};
+			double y = {cell_y + (origin / VISIBILITY_ORIGINS + 0.5) / VISIBILITY_ORIGINS};
+			for (int ray = 0; ray < VISIBILITY_RAYS; ray++) {
+				double angle = {2 * M_PI * (ray + (origin + 0.5) / origins) / VISIBILITY_RAYS};
+				double dist = {walk_ray(map, x, y, std::cos(angle), std::sin(angle), marks)};
+				int sector = {ray * VISIBILITY_SECTORS / VISIBILITY_RAYS};
+				sector_reach[sector] = std::max(sector_reach[sector], dist);
+			}
+		}
+
+		// Rays could start anywhere in the cell and point either side of a sector's edge, so each sector reaches as
+		// far as its neighbours, and a couple of squares further
+		for (int sector = 0; sector < VISIBILITY_SECTORS; sector++) {
+			double reach = {std::max({sector_reach[(sector + VISIBILITY_SECTORS - 1) % VISIBILITY_SECTORS],
+				sector_reach[sector], sector_reach[(sector + 1) % VISIBILITY_SECTORS]}) + 2};
+			cell.reach[sector] = static_cast<std::uint8_t>(std::min(std::ceil(reach), 1.0 * VISIBILITY_UNBOUNDED));
+		}
+
+		// Box everything seen, a cell wider all round, and set the bits of everything seen and the cells around it
+		int min_x = {map.width};
+		int min_y = {map.height};
+		int max_x = {-1};
+		int max_y = {-1};
+		for (int index : marks.marked) {
+			min_x = std::min(min_x, index % map.width);
+			max_x = std::max(max_x, index % map.width);
+			min_y = std::min(min_y, index / map.width);
+			max_y = std::max(max_y, index / map.width);
+		}
+		min_x = std::max(min_x - 1, 0);
+		min_y = std::max(min_y - 1, 0);
+		max_x = std::min(max_x + 1, map.width - 1);
+		max_y = std::min(max_y + 1, map.height - 1);
+		cell.box = {static_cast<std::int16_t>(min_x), static_cast<std::int16_t>(min_y),
+			static_cast<std::int16_t>(max_x - min_x + 1), static_cast<std::int16_t>(max_y - min_y + 1)};
+		cell.words.assign((cell.box.width * cell.box.height + 63) / 64, 0);
+		for (int index : marks.marked) {
+			for (int y = std::max(index / map.width - 1, min_y); y <= std::min(index / map.width + 1, max_y); y++) {
+				for (int x = std::max(index % map.width - 1, min_x); x <= std::min(index % map.width + 1, max_x); x++) {
+					int bit = {(y - min_y) * cell.box.width + x - min_x};
+					cell.words[bit / 64] |= std::uint64_t{1} << (bit % 64);
+				}
+			}
+			marks.seen[index] = 0;
+		}
+		marks.marked.clear();
+
+		return cell;
+	}
+
+	// Whether count things of type T starting at a byte offset lie within the file
+	template <typename T>
+	auto is_in_file(std::uint64_t at, std::uint64_t count, std::size_t size) -> bool
+	{
+		return at <= size && count <= (size - at) / sizeof(T);
+	}
+}
+
+auto build_visibility(const GridMap& map, ThreadPool* pool) -> VisibilitySet
+{
+	if (static_cast<std::int64_t>(map.width) * map.height > VISIBILITY_MAX_CELLS)
+		return {};
+
+	// Rows of cells are worked out on whichever thread takes them, each with marks of its own
+	std::vector<CellVisibility> cells(static_cast<std::size_t>(map.width) * map.height);
+	auto build_row = [&map, &cells](int y) {
+		if (thread_marks.seen.size() != cells.size())
+			thread_marks.seen.assign(cells.size(), 0);
+		for (int x = 0; x < map.width; x++)
+			cells[static_cast<std::size_t>(y) * map.width + x] = build_cell(map, x, y, thread_marks);
+	};
+	if (pool == nullptr)
+		for (int y = 0; y < map.height; y++)
+			build_row(y);
+	else
+		pool->parallel_for(map.height, build_row);
+
+	VisibilitySet visibility = {map.width, map.height, {}, {0}, {}, {}};
+	for (const CellVisibility& cell : cells) {
+		visibility.boxes.push_back(cell.box);
+		visibility.words.insert(visibility.words.end(), cell.words.begin(), cell.words.end());
+		visibility.starts.push_back(visibility.words.size());
+		visibility.reach.insert(visibility.reach.end(), std::begin(cell.reach), std::end(cell.reach));
+	}
+
+	return visibility;
+}
+
+auto load_visibility(const char* file, std::uint64_t key) -> VisibilitySet
+{
+	// A missing, damaged or stale set is the same as none at all, so nothing is reported
+	std::ifstream in(file, std::ios::binary);
+	if (!in)
+		return {};
+	std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::size_t size = {contents.size()};
+	if (size < sizeof(VisibilityHeader))
+		return {};
+
+	VisibilityHeader header = {};
+	std::memcpy(&header, contents.data(), sizeof(header));
+	if (std::memcmp(header.magic, VISIBILITY_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != VISIBILITY_VERSION || header.sectors != VISIBILITY_SECTORS || header.key != key ||
+		header.width <= 0 || header.height <= 0)
+		return {};
+
+	std::uint64_t cells = {static_cast<std::uint64_t>(header.width) * header.height};
+	std::uint64_t at = {sizeof(VisibilityHeader)};
+	std::uint64_t boxes_at = {at};
+	std::uint64_t starts_at = {boxes_at + cells * sizeof(VisibleBox)};
+	std::uint64_t reach_at = {starts_at + (cells + 1) * sizeof(std::uint64_t)};
+	std::uint64_t words_at = {reach_at + cells * VISIBILITY_SECTORS};
+	if (!is_in_file<VisibleBox>(boxes_at, cells, size) || !is_in_file<std::uint64_t>(starts_at, cells + 1, size) ||
+		!is_in_file<std::uint8_t>(reach_at, cells * VISIBILITY_SECTORS, size) ||
+		!is_in_file<std::uint64_t>(words_at, header.word_count, size))
+		return {};
+
+	VisibilitySet visibility = {header.width, header.height, std::vector<VisibleBox>(cells),
+		std::vector<std::uint64_t>(cells + 1), std::vector<std::uint8_t>(cells * VISIBILITY_SECTORS),
+		std::vector<std::uint64_t>(header.word_count)};
+	std::memcpy(visibility.boxes.data(), contents.data() + boxes_at, cells * sizeof(VisibleBox));
+	std::memcpy(visibility.starts.data(), contents.data() + starts_at, (cells + 1) * sizeof(std::uint64_t));
+	std::memcpy(visibility.reach.data(), contents.data() + reach_at, cells * VISIBILITY_SECTORS);
+	std::memcpy(visibility.words.data(), contents.data() + words_at, header.word_count * sizeof(std::uint64_t));
+
+	// Every cell's bits have to lie within the words and cover its box
+	for (std::uint64_t cell = 0; cell < cells; cell++) {
+		const VisibleBox& box = {visibility.boxes[cell]};
+		std::uint64_t bits = {static_cast<std::uint64_t>(std::max<int>(box.width, 0)) * std::max<int>(box.height, 0)};
+		if (box.width < 0 || box.height < 0 || visibility.starts[cell] > visibility.starts[cell + 1] ||
+			visibility.starts[cell + 1] > header.word_count ||
+			visibility.starts[cell + 1] - visibility.starts[cell] < (bits + 63) / 64)
+			return {};
+	}
+
+	return visibility;
+}
+
+auto save_visibility(const char* file, std::uint64_t key, const VisibilitySet& visibility) -> bool
+{
+	// Written alongside and then moved over the old one, so a set is never left half written
+	VisibilityHeader header = {{}, VISIBILITY_VERSION, VISIBILITY_SECTORS, key, visibility.width, visibility.height,
+		visibility.words.size()};
+	std::memcpy(header.magic, VISIBILITY_MAGIC, sizeof(header.magic));
+	std::filesystem::path path = {file};
+	std::filesystem::path written = {path.string() + ".tmp"};
+	std::error_code error = {};
+	std::ofstream out(written, std::ios::binary | std::ios::trunc);
+	if (out) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(visibility.boxes.data()), visibility.boxes.size() * sizeof(VisibleBox));
+		out.write(reinterpret_cast<const char*>(visibility.starts.data()),
+			visibility.starts.size() * sizeof(std::uint64_t));
+		out.write(reinterpret_cast<const char*>(visibility.reach.data()), visibility.reach.size());
+		out.write(reinterpret_cast<const char*>(visibility.words.data()),
+			visibility.words.size() * sizeof(std::uint64_t));
+		out.close();
+	}
+	if (!out) {
+		std::cout << "Visibility " << file << " could not be written!" << std::endl;
+		std::filesystem::remove(written, error);
+		return false;
+	}
+	std::filesystem::rename(written, path, error);
+
+	return !error;
+}